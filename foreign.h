@@ -73,6 +73,8 @@
 #define STR_SIZE1	"Use arrows to size"
 #define STR_SIZE2	"ENTER to accept"
 #define STR_SIZE3	"ESC to cancel"
+#define STR_HIDETAIL	"SPACE for low detail"
+#define STR_LODETAIL	"SPACE for high detail"
 
 #define STR_YOUWIN	"you win!"
 
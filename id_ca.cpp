@@ -42,6 +42,22 @@ typedef struct
     word bit0,bit1;       // 0-255 is a character, > is a pointer to a node
 } huffnode;
 
+//
+// The huffman codes are decoded with lookup tables instead of walking the
+// tree one bit at a time. The first HUFFLOOKUPBITS bits of a code index the
+// main table, longer codes continue in subtables of HUFFSUBBITS bits.
+//
+#define HUFFLOOKUPBITS  10
+#define HUFFSUBBITS     6
+#define HUFFLOOKUPSIZE  ((1 << HUFFLOOKUPBITS) + 255 * (1 << HUFFSUBBITS))
+
+typedef struct
+{
+    word value;           // character or first entry of the subtable
+    byte bits;            // number of bits used from this table
+    byte subbits;         // size of the subtable, 0 for characters
+} hufflookup_t;
+
 
 typedef struct
 {
@@ -101,6 +117,7 @@ huffnode *grhuffman;
 #else
 huffnode grhuffman[255];
 #endif
+hufflookup_t grhufflookup[HUFFLOOKUPSIZE];
 
 int    grhandle = -1;               // handle to EGAGRAPH
 int    maphandle = -1;              // handle to MAPTEMP / GAMEMAPS
@@ -210,10 +227,104 @@ boolean CA_LoadFile (const char *filename, memptr *ptr)
 ============================================================================
 */
 
-static void CAL_HuffExpand(byte *source, byte *dest, int32_t length, huffnode *hufftable)
+/*
+======================
+=
+= CAL_BuildHuffTable
+=
+= Fills the 1 << bits entries of a lookup table starting at the given node
+= and builds the subtables for the nodes reached after all bits. The bits
+= of a code are taken from the lowest bit upwards. Returns the next free
+= entry.
+=
+======================
+*/
+
+static int32_t CAL_BuildHuffTable(huffnode *hufftable, hufflookup_t *lookup, int32_t start,
+    int node, int bits, int32_t *subtables)
 {
-    byte *end;
-    huffnode *headptr, *huffptr;
+    int32_t next = start + (1 << bits);
+    int32_t code;
+    int depth, cur;
+    word nodeval;
+
+    for(code = 0; code < (1 << bits); code++)
+    {
+        hufflookup_t entry;
+
+        cur = node;
+        for(depth = 0; depth < bits; depth++)
+        {
+            nodeval = (code >> depth) & 1 ? hufftable[cur].bit1 : hufftable[cur].bit0;
+            if(nodeval < 256)
+                break;
+            cur = nodeval - 256;
+            if(cur >= 255)
+                Quit("CAL_BuildHuffTable: Broken huffman dictionary!");
+        }
+
+        if(depth < bits)
+        {
+            entry.value = nodeval;
+            entry.bits = (byte) (depth + 1);
+            entry.subbits = 0;
+        }
+        else
+        {
+            if(subtables[cur] < 0)
+            {
+                if(next + (1 << HUFFSUBBITS) > HUFFLOOKUPSIZE)
+                    Quit("CAL_BuildHuffTable: Broken huffman dictionary!");
+                subtables[cur] = next;
+                next = CAL_BuildHuffTable(hufftable, lookup, next, cur, HUFFSUBBITS, subtables);
+            }
+            entry.value = (word) subtables[cur];
+            entry.bits = (byte) bits;
+            entry.subbits = HUFFSUBBITS;
+        }
+        lookup[start + code] = entry;
+    }
+    return next;
+}
+
+/*
+======================
+=
+= CAL_BuildHuffLookup
+=
+= Builds the lookup tables of a huffman dictionary for CAL_HuffExpand
+=
+======================
+*/
+
+static void CAL_BuildHuffLookup(huffnode *hufftable, hufflookup_t *lookup)
+{
+    int32_t subtables[255];
+    int i;
+
+    for(i = 0; i < 255; i++)
+        subtables[i] = -1;
+    CAL_BuildHuffTable(hufftable, lookup, 0, 254, HUFFLOOKUPBITS, subtables);   // head node is always node 254
+}
+
+/*
+======================
+=
+= CAL_HuffExpand
+=
+= Length is the length of the EXPANDED data. Never reads more than
+= sourcelength bytes, missing bits of broken chunks are read as zeros.
+=
+======================
+*/
+
+static void CAL_HuffExpand(byte *source, int32_t sourcelength, byte *dest, int32_t length,
+    hufflookup_t *lookup)
+{
+    byte *end, *sourceend;
+    hufflookup_t *entry;
+    uint32_t bitbuf = 0;
+    int bitcount = 0, subbits;
 
     if(!length || !dest)
     {
@@ -221,40 +332,36 @@ static void CAL_HuffExpand(byte *source, byte *dest, int32_t length, huffnode *h
         return;
     }
 
-    headptr = hufftable+254;        // head node is always node 254
-
-    int written = 0;
+    end = dest + length;
+    sourceend = source + sourcelength;
 
-    end=dest+length;
-
-    byte val = *source++;
-    byte mask = 1;
-    word nodeval;
-    huffptr = headptr;
-    while(1)
+    while(dest < end)
     {
-        if(!(val & mask))
-            nodeval = huffptr->bit0;
-        else
-            nodeval = huffptr->bit1;
-        if(mask==0x80)
+        while(bitcount <= 24)
         {
-            val = *source++;
-            mask = 1;
+            if(source < sourceend)
+                bitbuf |= (uint32_t) *source++ << bitcount;
+            bitcount += 8;
         }
-        else mask <<= 1;
 
-        if(nodeval<256)
+        entry = &lookup[bitbuf & ((1 << HUFFLOOKUPBITS) - 1)];
+        while(entry->subbits)
         {
-            *dest++ = (byte) nodeval;
-            written++;
-            huffptr = headptr;
-            if(dest>=end) break;
-        }
-        else
-        {
-            huffptr = hufftable + (nodeval - 256);
+            subbits = entry->subbits;
+            bitbuf >>= entry->bits;
+            bitcount -= entry->bits;
+            while(bitcount <= 24)
+            {
+                if(source < sourceend)
+                    bitbuf |= (uint32_t) *source++ << bitcount;
+                bitcount += 8;
+            }
+            entry = &lookup[entry->value + (bitbuf & ((1 << subbits) - 1))];
         }
+
+        bitbuf >>= entry->bits;
+        bitcount -= entry->bits;
+        *dest++ = (byte) entry->value;
     }
 }
 
@@ -263,7 +370,12 @@ static void CAL_HuffExpand(byte *source, byte *dest, int32_t length, huffnode *h
 =
 = CAL_CarmackExpand
 =
-= Length is the length of the EXPANDED data
+= Length is the length of the EXPANDED data, sourcelength the length of the
+= compressed data. Returns false for malformed data instead of reading past
+= the source or writing past dest.
+=
+= Copies not overlapping the words they produce move four words at a time,
+= overlapping ones repeat their pattern a word at a time
 =
 ======================
 */
@@ -271,65 +383,68 @@ static void CAL_HuffExpand(byte *source, byte *dest, int32_t length, huffnode *h
 #define NEARTAG 0xa7
 #define FARTAG  0xa8
 
-void CAL_CarmackExpand (byte *source, word *dest, int length)
+boolean CAL_CarmackExpand (byte *source, int32_t sourcelength, word *dest, int32_t length)
 {
     word ch,chhigh,count,offset;
-    byte *inptr;
-    word *copyptr, *outptr;
-
-    length/=2;
+    byte *inptr, *inend;
+    word *copyptr, *outptr, *outend;
 
-    inptr = (byte *) source;
+    inptr = source;
+    inend = source + sourcelength;
     outptr = dest;
+    outend = dest + length/2;
 
-    while (length>0)
+    while (outptr < outend)
     {
+        if (inend - inptr < 2)
+            return false;
         ch = READWORD(inptr);
         chhigh = ch>>8;
-        if (chhigh == NEARTAG)
+        if (chhigh != NEARTAG && chhigh != FARTAG)
         {
-            count = ch&0xff;
-            if (!count)
-            {                               // have to insert a word containing the tag byte
-                ch |= *inptr++;
-                *outptr++ = ch;
-                length--;
-            }
-            else
-            {
-                offset = *inptr++;
-                copyptr = outptr - offset;
-                length -= count;
-                if(length<0) return;
-                while (count--)
-                    *outptr++ = *copyptr++;
-            }
+            *outptr++ = ch;
+            continue;
         }
-        else if (chhigh == FARTAG)
+
+        count = ch&0xff;
+        if (!count)
+        {                               // have to insert a word containing the tag byte
+            if (inptr == inend)
+                return false;
+            *outptr++ = ch | *inptr++;
+            continue;
+        }
+        if (count > outend - outptr)
+            return false;
+
+        if (chhigh == NEARTAG)
         {
-            count = ch&0xff;
-            if (!count)
-            {                               // have to insert a word containing the tag byte
-                ch |= *inptr++;
-                *outptr++ = ch;
-                length --;
-            }
-            else
-            {
-                offset = READWORD(inptr);
-                copyptr = dest + offset;
-                length -= count;
-                if(length<0) return;
-                while (count--)
-                    *outptr++ = *copyptr++;
-            }
+            if (inptr == inend)
+                return false;
+            offset = *inptr++;
+            if (!offset || offset > outptr - dest)
+                return false;
+            copyptr = outptr - offset;
         }
         else
         {
-            *outptr++ = ch;
-            length --;
+            if (inend - inptr < 2)
+                return false;
+            offset = READWORD(inptr);
+            if (offset >= outptr - dest)
+                return false;
+            copyptr = dest + offset;
         }
+
+        if (copyptr + count <= outptr)
+        {
+            for (; count >= 4; count -= 4, copyptr += 4, outptr += 4)
+                memcpy (outptr, copyptr, 4*sizeof(word));
+        }
+        while (count--)
+            *outptr++ = *copyptr++;
     }
+    return true;
 }
 
 /*
@@ -390,38 +505,55 @@ int32_t CA_RLEWCompress (word *source, int32_t length, word *dest, word rlewtag)
 ======================
 =
 = CA_RLEWexpand
-= length is EXPANDED length
+= length is EXPANDED length, sourcelength the length of the compressed data
+=
+= Returns false for malformed data instead of reading past the source or
+= writing past dest. Runs are filled four words at a time.
 =
 ======================
 */
 
-void CA_RLEWexpand (word *source, word *dest, int32_t length, word rlewtag)
+boolean CA_RLEWexpand (word *source, int32_t sourcelength, word *dest, int32_t length, word rlewtag)
 {
-    word value,count,i;
+    word value,count;
+    word pattern[4];
+    word *srcend=source+sourcelength/2;
     word *end=dest+length/2;
 
 //
 // expand it
 //
-    do
+    while (dest<end)
     {
+        if (source >= srcend)
+            return false;
         value = *source++;
         if (value != rlewtag)
+        {
             //
             // uncompressed
             //
             *dest++=value;
-        else
-        {
-            //
-            // compressed string
-            //
-            count = *source++;
-            value = *source++;
-            for (i=1;i<=count;i++)
-                *dest++ = value;
+            continue;
         }
-    } while (dest<end);
+
+        //
+        // compressed string
+        //
+        if (srcend - source < 2)
+            return false;
+        count = *source++;
+        value = *source++;
+        if (count > end - dest)
+            return false;
+
+        pattern[0] = pattern[1] = pattern[2] = pattern[3] = value;
+        for (; count >= 4; count -= 4, dest += 4)
+            memcpy (dest,pattern,sizeof(pattern));
+        while (count--)
+            *dest++ = value;
+    }
+    return true;
 }
 
 
@@ -518,6 +650,8 @@ void CAL_SetupGrFile (void)
         CA_CannotOpen(fname);
 
 
+    CAL_BuildHuffLookup(grhuffman, grhufflookup);
+
 //
 // load the pic and sprite headers into the arrays in the data segment
 //
@@ -527,7 +661,7 @@ void CAL_SetupGrFile (void)
     compseg=(byte *) malloc(chunkcomplen);
     CHECKMALLOCRESULT(compseg);
     read (grhandle,compseg,chunkcomplen);
-    CAL_HuffExpand(compseg, (byte*)pictable, NUMPICS * sizeof(pictabletype), grhuffman);
+    CAL_HuffExpand(compseg, chunkcomplen, (byte*)pictable, NUMPICS * sizeof(pictabletype), grhufflookup);
     free(compseg);
 }
 
@@ -862,7 +996,7 @@ cachein:
 ======================
 */
 
-void CAL_ExpandGrChunk (int chunk, int32_t *source)
+static int32_t CAL_GrChunkLength (int chunk, int32_t **source)
 {
     int32_t    expanded;
 
@@ -893,8 +1027,17 @@ void CAL_ExpandGrChunk (int chunk, int32_t *source)
         //
         // everything else has an explicit size longword
         //
-        expanded = *source++;
+        expanded = *(*source)++;
     }
+    return expanded;
+}
+
+void CAL_ExpandGrChunk (int chunk, int32_t *source, int32_t compressed)
+{
+    int32_t    *data = source;
+    int32_t    expanded = CAL_GrChunkLength (chunk, &source);
+
+    compressed -= (int32_t) ((source - data) * sizeof(int32_t));
 
     //
     // allocate final space, decompress it, and free bigbuffer
@@ -902,7 +1045,7 @@ void CAL_ExpandGrChunk (int chunk, int32_t *source)
     //
     grsegs[chunk]=(byte *) malloc(expanded);
     CHECKMALLOCRESULT(grsegs[chunk]);
-    CAL_HuffExpand((byte *) source, grsegs[chunk], expanded, grhuffman);
+    CAL_HuffExpand((byte *) source, compressed, grsegs[chunk], expanded, grhufflookup);
 }
 
 
@@ -953,7 +1096,7 @@ void CA_CacheGrChunk (int chunk)
         read(grhandle,source,compressed);
     }
 
-    CAL_ExpandGrChunk (chunk,source);
+    CAL_ExpandGrChunk (chunk,source,compressed);
 
     if (compressed>BUFFERSIZE)
         free(source);
@@ -1004,26 +1147,62 @@ void CA_CacheScreen (int chunk)
 //
     byte *pic = (byte *) malloc(64000);
     CHECKMALLOCRESULT(pic);
-    CAL_HuffExpand((byte *) source, pic, expanded, grhuffman);
+    CAL_HuffExpand((byte *) source, compressed - 4, pic, expanded, grhufflookup);
 
-    byte *vbuf = LOCK();
-    for(int y = 0, scy = 0; y < 200; y++, scy += scaleFactor)
-    {
-        for(int x = 0, scx = 0; x < 320; x++, scx += scaleFactor)
-        {
-            byte col = pic[(y * 80 + (x >> 2)) + (x & 3) * 80 * 200];
-            for(unsigned i = 0; i < scaleFactor; i++)
-                for(unsigned j = 0; j < scaleFactor; j++)
-                    vbuf[(scy + i) * curPitch + scx + j] = col;
-        }
-    }
-    UNLOCK();
+    VL_MemToScreenScaledCoord(pic, 320, 200, 0, 0);
     free(pic);
     free(bigbufferseg);
 }
 
 //==========================================================================
 
+/*
+======================
+=
+= CAL_ExpandMapPlane
+=
+= Expands a compressed map plane into size bytes at dest
+= Returns false if the plane is malformed
+=
+======================
+*/
+
+static boolean CAL_ExpandMapPlane (word *source, int32_t compressed, word *dest, unsigned size)
+{
+#ifdef CARMACIZED
+    word     *buffer2seg;
+    int32_t   expanded;
+    boolean   ok;
+
+    //
+    // unhuffman, then unRLEW
+    // The huffman'd chunk has a two byte expanded length first
+    // The resulting RLEW chunk also does, even though it's not really
+    // needed
+    //
+    if (compressed < 2)
+        return false;
+    expanded = *source;
+    source++;
+    if (expanded < 2)
+        return false;
+    buffer2seg = (word *) malloc(expanded);
+    CHECKMALLOCRESULT(buffer2seg);
+    ok = CAL_CarmackExpand((byte *) source, compressed-2, buffer2seg, expanded)
+        && CA_RLEWexpand(buffer2seg+1, expanded-2, dest, size, RLEWtag);
+    free(buffer2seg);
+    return ok;
+
+#else
+    //
+    // unRLEW, skipping expanded length
+    //
+    if (compressed < 2)
+        return false;
+    return CA_RLEWexpand (source+1, compressed-2, dest, size, RLEWtag);
+#endif
+}
+
 /*
 ======================
 =
@@ -1042,10 +1221,6 @@ void CA_CacheMap (int mapnum)
     memptr    bigbufferseg;
     unsigned  size;
     word     *source;
-#ifdef CARMACIZED
-    word     *buffer2seg;
-    int32_t   expanded;
-#endif
 
     mapon = mapnum;
 
@@ -1071,34 +1246,598 @@ void CA_CacheMap (int mapnum)
             source = (word *) bigbufferseg;
         }
 
-        read(maphandle,source,compressed);
+        if (read(maphandle,source,compressed) != compressed
+            || !CAL_ExpandMapPlane(source,compressed,dest,size))
+            Quit("CA_CacheMap: Plane %i of map %i is corrupt!",plane,mapnum);
+
+        if (compressed>BUFFERSIZE)
+            free(bigbufferseg);
+    }
+}
+
+#ifdef CA_BENCHMARKS
+
+/*
+=============================================================================
+
+                                BENCHMARKS
+
+Only built with CA_BENCHMARKS (see version.h)
+
+=============================================================================
+*/
+
+/*
+======================
+=
+= CAL_HuffExpandBits
+=
+= The original decoder walking the huffman tree one bit at a time, kept to
+= check CAL_HuffExpand against
+=
+======================
+*/
+
+static void CAL_HuffExpandBits(byte *source, byte *dest, int32_t length, huffnode *hufftable)
+{
+    byte *end;
+    huffnode *headptr, *huffptr;
+
+    headptr = hufftable+254;        // head node is always node 254
+
+    end=dest+length;
+
+    byte val = *source++;
+    byte mask = 1;
+    word nodeval;
+    huffptr = headptr;
+    while(1)
+    {
+        if(!(val & mask))
+            nodeval = huffptr->bit0;
+        else
+            nodeval = huffptr->bit1;
+        if(mask==0x80)
+        {
+            val = *source++;
+            mask = 1;
+        }
+        else mask <<= 1;
+
+        if(nodeval<256)
+        {
+            *dest++ = (byte) nodeval;
+            huffptr = headptr;
+            if(dest>=end) break;
+        }
+        else
+        {
+            huffptr = hufftable + (nodeval - 256);
+        }
+    }
+}
+
+/*
+======================
+=
+= CAL_RandomHuffTree
+=
+= Builds a huffman dictionary by joining random characters and nodes
+=
+======================
+*/
+
+static void CAL_RandomHuffTree(huffnode *hufftable)
+{
+    word items[256];
+    int count, i, j, node;
+
+    for(count = 0; count < 256; count++)
+        items[count] = count;
+
+    for(node = 0; node < 255; node++)
+    {
+        i = rand() % count;
+        hufftable[node].bit0 = items[i];
+        items[i] = items[--count];
+        j = rand() % count;
+        hufftable[node].bit1 = items[j];
+        items[j] = 256 + node;
+    }
+}
+
+/*
+======================
+=
+= CA_HuffBenchmark
+=
+= Checks CAL_HuffExpand against the original decoder with random
+= dictionaries and data and with every graphics chunk and compares the
+= decoding speed of both with the graphics chunks (--huffbench)
+=
+======================
+*/
+
+#define HUFFBENCHTREES      100
+#define HUFFBENCHSTREAMS    20
+#define HUFFBENCHROUNDS     20
+
+void CA_HuffBenchmark (void)
+{
+    static huffnode testtree[255];
+    static hufflookup_t testlookup[HUFFLOOKUPSIZE];
+    byte    **buffers, **sources, *expect, *result, *data;
+    int32_t *complens, *explens, *source;
+    int32_t pos, compressed, expanded, maxexpanded, total;
+    int     chunk, next, numchunks, tree, stream, round, i, mismatches;
+    uint32_t start, treetime, tabletime;
+
+    mismatches = 0;
+    srand(1);
+
+//
+// random dictionaries and data, the first one is the dictionary of the game
+//
+    for(tree = 0; tree < HUFFBENCHTREES; tree++)
+    {
+        if(tree)
+        {
+            CAL_RandomHuffTree(testtree);
+            CAL_BuildHuffLookup(testtree, testlookup);
+        }
+
+        for(stream = 0; stream < HUFFBENCHSTREAMS; stream++)
+        {
+            expanded = 1 + rand() % 4096;
+            compressed = expanded * 32 + 1;         // codes may be 255 bits long
+            data = (byte *) malloc(compressed);
+            expect = (byte *) malloc(expanded);
+            result = (byte *) malloc(expanded);
+            CHECKMALLOCRESULT(data);
+            CHECKMALLOCRESULT(expect);
+            CHECKMALLOCRESULT(result);
+            for(i = 0; i < compressed; i++)
+                data[i] = (byte) rand();
+
+            CAL_HuffExpandBits(data, expect, expanded, tree ? testtree : grhuffman);
+            CAL_HuffExpand(data, compressed, result, expanded, tree ? testlookup : grhufflookup);
+            if(memcmp(expect, result, expanded))
+                mismatches++;
+
+            free(data);
+            free(expect);
+            free(result);
+        }
+    }
+
+//
+// load all graphics chunks
+//
+    buffers = (byte **) calloc(NUMCHUNKS, sizeof(*buffers));
+    sources = (byte **) calloc(NUMCHUNKS, sizeof(*sources));
+    complens = (int32_t *) calloc(NUMCHUNKS, sizeof(*complens));
+    explens = (int32_t *) calloc(NUMCHUNKS, sizeof(*explens));
+    CHECKMALLOCRESULT(buffers);
+    CHECKMALLOCRESULT(sources);
+    CHECKMALLOCRESULT(complens);
+    CHECKMALLOCRESULT(explens);
+
+    numchunks = total = maxexpanded = 0;
+    for(chunk = 0; chunk < NUMCHUNKS; chunk++)
+    {
+        pos = GRFILEPOS(chunk);
+        if(pos < 0)
+            continue;                       // sparse tile
+        next = chunk + 1;
+        while(next < NUMCHUNKS && GRFILEPOS(next) == -1)
+            next++;
+        compressed = GRFILEPOS(next) - pos;
+        if(compressed <= 4)
+            continue;
+
+        source = (int32_t *) calloc(compressed + 4, 1);     // the old decoder reads ahead
+        CHECKMALLOCRESULT(source);
+        lseek(grhandle, pos, SEEK_SET);
+        read(grhandle, source, compressed);
+
+        data = (byte *) source;
+        expanded = CAL_GrChunkLength(chunk, &source);
+        if(expanded <= 0)
+        {
+            free(data);
+            continue;
+        }
+        buffers[chunk] = data;
+        sources[chunk] = (byte *) source;
+        complens[chunk] = compressed - (int32_t) ((byte *) source - data);
+        explens[chunk] = expanded;
+        numchunks++;
+        total += expanded;
+        if(expanded > maxexpanded)
+            maxexpanded = expanded;
+    }
+
+    expect = (byte *) malloc(maxexpanded ? maxexpanded : 1);
+    result = (byte *) malloc(maxexpanded ? maxexpanded : 1);
+    CHECKMALLOCRESULT(expect);
+    CHECKMALLOCRESULT(result);
+
+    for(chunk = 0; chunk < NUMCHUNKS; chunk++)
+    {
+        if(!sources[chunk])
+            continue;
+        CAL_HuffExpandBits(sources[chunk], expect, explens[chunk], grhuffman);
+        CAL_HuffExpand(sources[chunk], complens[chunk], result, explens[chunk], grhufflookup);
+        if(memcmp(expect, result, explens[chunk]))
+            mismatches++;
+    }
+
+//
+// time both decoders
+//
+    start = SDL_GetTicks();
+    for(round = 0; round < HUFFBENCHROUNDS; round++)
+    {
+        for(chunk = 0; chunk < NUMCHUNKS; chunk++)
+        {
+            if(sources[chunk])
+                CAL_HuffExpandBits(sources[chunk], expect, explens[chunk], grhuffman);
+        }
+    }
+    treetime = SDL_GetTicks() - start;
+
+    start = SDL_GetTicks();
+    for(round = 0; round < HUFFBENCHROUNDS; round++)
+    {
+        for(chunk = 0; chunk < NUMCHUNKS; chunk++)
+        {
+            if(sources[chunk])
+                CAL_HuffExpand(sources[chunk], complens[chunk], result, explens[chunk], grhufflookup);
+        }
+    }
+    tabletime = SDL_GetTicks() - start;
+
+    printf("huffbench: %i random dictionaries with %i streams each, %i chunks (%i KB): %i mismatches\n",
+        HUFFBENCHTREES, HUFFBENCHSTREAMS, numchunks, total / 1024, mismatches);
+    printf("huffbench: %i rounds, tree walk %u ms, lookup tables %u ms\n",
+        HUFFBENCHROUNDS, treetime, tabletime);
+
+    for(chunk = 0; chunk < NUMCHUNKS; chunk++)
+        free(buffers[chunk]);
+    free(buffers);
+    free(sources);
+    free(complens);
+    free(explens);
+    free(expect);
+    free(result);
+}
+
+/*
+======================
+=
+= CAL_CarmackExpandWords
+=
+= The original expander copying a word at a time without any checks, kept
+= to check CAL_CarmackExpand against
+=
+======================
+*/
+
+static void CAL_CarmackExpandWords (byte *source, word *dest, int length)
+{
+    word ch,chhigh,count,offset;
+    byte *inptr;
+    word *copyptr, *outptr;
+
+    length/=2;
+
+    inptr = (byte *) source;
+    outptr = dest;
+
+    while (length>0)
+    {
+        ch = READWORD(inptr);
+        chhigh = ch>>8;
+        if (chhigh == NEARTAG)
+        {
+            count = ch&0xff;
+            if (!count)
+            {                               // have to insert a word containing the tag byte
+                ch |= *inptr++;
+                *outptr++ = ch;
+                length--;
+            }
+            else
+            {
+                offset = *inptr++;
+                copyptr = outptr - offset;
+                length -= count;
+                if(length<0) return;
+                while (count--)
+                    *outptr++ = *copyptr++;
+            }
+        }
+        else if (chhigh == FARTAG)
+        {
+            count = ch&0xff;
+            if (!count)
+            {                               // have to insert a word containing the tag byte
+                ch |= *inptr++;
+                *outptr++ = ch;
+                length --;
+            }
+            else
+            {
+                offset = READWORD(inptr);
+                copyptr = dest + offset;
+                length -= count;
+                if(length<0) return;
+                while (count--)
+                    *outptr++ = *copyptr++;
+            }
+        }
+        else
+        {
+            *outptr++ = ch;
+            length --;
+        }
+    }
+}
+
+/*
+======================
+=
+= CAL_RLEWexpandWords
+=
+= The original expander filling runs a word at a time without any checks,
+= kept to check CA_RLEWexpand against
+=
+======================
+*/
+
+static void CAL_RLEWexpandWords (word *source, word *dest, int32_t length, word rlewtag)
+{
+    word value,count,i;
+    word *end=dest+length/2;
+
+    do
+    {
+        value = *source++;
+        if (value != rlewtag)
+            *dest++=value;
+        else
+        {
+            count = *source++;
+            value = *source++;
+            for (i=1;i<=count;i++)
+                *dest++ = value;
+        }
+    } while (dest<end);
+}
+
+/*
+======================
+=
+= CAL_ExpandMapPlaneWords
+=
+= CAL_ExpandMapPlane with the original expanders
+=
+======================
+*/
+
+static void CAL_ExpandMapPlaneWords (word *source, word *dest, unsigned size)
+{
 #ifdef CARMACIZED
-        //
-        // unhuffman, then unRLEW
-        // The huffman'd chunk has a two byte expanded length first
-        // The resulting RLEW chunk also does, even though it's not really
-        // needed
-        //
-        expanded = *source;
-        source++;
-        buffer2seg = (word *) malloc(expanded);
-        CHECKMALLOCRESULT(buffer2seg);
-        CAL_CarmackExpand((byte *) source, buffer2seg,expanded);
-        CA_RLEWexpand(buffer2seg+1,dest,size,RLEWtag);
-        free(buffer2seg);
+    word     *buffer2seg;
+    int32_t   expanded;
 
+    expanded = *source;
+    source++;
+    buffer2seg = (word *) malloc(expanded);
+    CHECKMALLOCRESULT(buffer2seg);
+    CAL_CarmackExpandWords((byte *) source, buffer2seg, expanded);
+    CAL_RLEWexpandWords(buffer2seg+1, dest, size, RLEWtag);
+    free(buffer2seg);
 #else
-        //
-        // unRLEW, skipping expanded length
-        //
-        CA_RLEWexpand (source+1,dest,size,RLEWtag);
+    CAL_RLEWexpandWords(source+1, dest, size, RLEWtag);
 #endif
+}
 
-        if (compressed>BUFFERSIZE)
-            free(bigbufferseg);
+/*
+======================
+=
+= CAL_SetGuardWords / CAL_GuardWordsIntact
+=
+= Fill the words behind a buffer with a known value and check whether they
+= still have it
+=
+======================
+*/
+
+#define MAPBENCHGUARD   64
+#define GUARDWORD       0xdead
+
+static void CAL_SetGuardWords (word *guard)
+{
+    for(int i = 0; i < MAPBENCHGUARD; i++)
+        guard[i] = GUARDWORD;
+}
+
+static boolean CAL_GuardWordsIntact (word *guard)
+{
+    for(int i = 0; i < MAPBENCHGUARD; i++)
+    {
+        if(guard[i] != GUARDWORD)
+            return false;
     }
+    return true;
 }
 
+/*
+======================
+=
+= CA_MapBenchmark
+=
+= Checks the map expanders against the original ones with every plane of
+= every map, checks that they reject randomly damaged planes without
+= writing past their buffers and compares the speed of both (--mapbench)
+=
+======================
+*/
+
+#define MAPBENCHMUTATIONS   50
+#define MAPBENCHROUNDS      50
+
+void CA_MapBenchmark (void)
+{
+    static word *sources[NUMMAPS*MAPPLANES];
+    static int32_t complens[NUMMAPS*MAPPLANES];
+    word    *expect, *result, *data;
+    int32_t pos, compressed;
+    int     mapnum, plane, p, numplanes, round, mutation, i;
+    int     mismatches, mutated, rejected, overruns;
+    unsigned size;
+    uint32_t start, wordtime, widetime;
+#ifdef CARMACIZED
+    word    *buffer2seg;
+    int32_t expanded;
+#endif
+
+    size = maparea*2;
+    expect = (word *) malloc(size);
+    result = (word *) malloc(size + MAPBENCHGUARD*sizeof(word));
+    CHECKMALLOCRESULT(expect);
+    CHECKMALLOCRESULT(result);
+
+//
+// load all map planes
+//
+    numplanes = 0;
+    for(mapnum = 0; mapnum < NUMMAPS; mapnum++)
+    {
+        for(plane = 0; plane < MAPPLANES; plane++)
+        {
+            p = mapnum*MAPPLANES + plane;
+            sources[p] = NULL;
+            if(!mapheaderseg[mapnum])
+                continue;                   // sparse map
+            pos = mapheaderseg[mapnum]->planestart[plane];
+            compressed = mapheaderseg[mapnum]->planelength[plane];
+            if(pos <= 0 || compressed < 2)
+                continue;
+
+            sources[p] = (word *) malloc(compressed);
+            CHECKMALLOCRESULT(sources[p]);
+            lseek(maphandle, pos, SEEK_SET);
+            if(read(maphandle, sources[p], compressed) != compressed)
+                Quit("CA_MapBenchmark: Plane %i of map %i is corrupt!", plane, mapnum);
+            complens[p] = compressed;
+            numplanes++;
+        }
+    }
+
+//
+// compare the output of both expanders
+//
+    mismatches = 0;
+    for(p = 0; p < NUMMAPS*MAPPLANES; p++)
+    {
+        if(!sources[p])
+            continue;
+        CAL_ExpandMapPlaneWords(sources[p], expect, size);
+        if(!CAL_ExpandMapPlane(sources[p], complens[p], result, size)
+            || memcmp(expect, result, size))
+            mismatches++;
+    }
+
+//
+// damage random bytes of every plane, the expanders must either reject
+// the plane or stay within their buffers
+//
+    srand(1);
+    mutated = rejected = overruns = 0;
+    for(p = 0; p < NUMMAPS*MAPPLANES; p++)
+    {
+        if(!sources[p])
+            continue;
+        compressed = complens[p];
+        data = (word *) malloc(compressed);
+        CHECKMALLOCRESULT(data);
+
+        for(mutation = 0; mutation < MAPBENCHMUTATIONS; mutation++)
+        {
+            memcpy(data, sources[p], compressed);
+            for(i = 1 + rand() % 4; i > 0; i--)
+                ((byte *) data)[rand() % compressed] = (byte) rand();
+            mutated++;
+
+            CAL_SetGuardWords(result + size/2);
+#ifdef CARMACIZED
+            expanded = data[0];
+            if(expanded < 2)
+            {
+                rejected++;
+                continue;
+            }
+            buffer2seg = (word *) malloc(expanded + MAPBENCHGUARD*sizeof(word));
+            CHECKMALLOCRESULT(buffer2seg);
+            CAL_SetGuardWords(buffer2seg + expanded/2);
+            if(!CAL_CarmackExpand((byte *) (data + 1), compressed - 2, buffer2seg, expanded)
+                || !CA_RLEWexpand(buffer2seg + 1, expanded - 2, result, size, RLEWtag))
+                rejected++;
+            if(!CAL_GuardWordsIntact(buffer2seg + expanded/2))
+                overruns++;
+            free(buffer2seg);
+#else
+            if(!CA_RLEWexpand(data + 1, compressed - 2, result, size, RLEWtag))
+                rejected++;
+#endif
+            if(!CAL_GuardWordsIntact(result + size/2))
+                overruns++;
+        }
+        free(data);
+    }
+
+//
+// time both expanders
+//
+    start = SDL_GetTicks();
+    for(round = 0; round < MAPBENCHROUNDS; round++)
+    {
+        for(p = 0; p < NUMMAPS*MAPPLANES; p++)
+        {
+            if(sources[p])
+                CAL_ExpandMapPlaneWords(sources[p], expect, size);
+        }
+    }
+    wordtime = SDL_GetTicks() - start;
+
+    start = SDL_GetTicks();
+    for(round = 0; round < MAPBENCHROUNDS; round++)
+    {
+        for(p = 0; p < NUMMAPS*MAPPLANES; p++)
+        {
+            if(sources[p])
+                CAL_ExpandMapPlane(sources[p], complens[p], result, size);
+        }
+    }
+    widetime = SDL_GetTicks() - start;
+
+    printf("mapbench: %i planes (%i KB expanded): %i mismatches\n",
+        numplanes, numplanes * size / 1024, mismatches);
+    printf("mapbench: %i damaged planes: %i rejected, %i overruns\n",
+        mutated, rejected, overruns);
+    printf("mapbench: %i rounds, word copies %u ms, wide copies %u ms\n",
+        MAPBENCHROUNDS, wordtime, widetime);
+
+    for(p = 0; p < NUMMAPS*MAPPLANES; p++)
+        free(sources[p]);
+    free(expect);
+    free(result);
+}
+
+#endif
+
 //===========================================================================
 
 void CA_CannotOpen(const char *string)
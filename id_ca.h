@@ -42,7 +42,7 @@ boolean CA_WriteFile (const char *filename, void *ptr, int32_t length);
 
 int32_t CA_RLEWCompress (word *source, int32_t length, word *dest, word rlewtag);
 
-void CA_RLEWexpand (word *source, word *dest, int32_t length, word rlewtag);
+boolean CA_RLEWexpand (word *source, int32_t sourcelength, word *dest, int32_t length, word rlewtag);
 
 void CA_Startup (void);
 void CA_Shutdown (void);
@@ -55,6 +55,11 @@ void CA_CacheMap (int mapnum);
 
 void CA_CacheScreen (int chunk);
 
+#ifdef CA_BENCHMARKS
+void CA_HuffBenchmark (void);
+void CA_MapBenchmark (void);
+#endif
+
 void CA_CannotOpen(const char *name);
 
 #endif
@@ -1,4 +1,11 @@
+#if !defined(_WIN32) && !defined(_arch_dreamcast)
+    #define PM_MAPPAGES             // the page file can be mapped with mmap and read with pread
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
 #include "wl_def.h"
+#include <SDL_thread.h>
 
 int ChunksInFile;
 int PMSpriteStart;
@@ -6,57 +13,574 @@ int PMSoundStart;
 
 bool PMSoundInfoPagePadded = false;
 
-// holds the whole VSWAP
+// holds the whole VSWAP, when it is read into memory
 uint32_t *PMPageData;
 size_t PMPageDataSize;
 
+#ifdef PM_MAPPAGES
+// the mapped page file and the copies of the pages misaligned in it
+static uint8_t *PMMapping;
+static size_t PMMappingSize;
+static uint8_t *PMAlignedPages;
+#endif
+
 // ChunksInFile+1 pointers to page starts.
 // The last pointer points one byte after the last page.
 uint8_t **PMPages;
+uint32_t *PMPageSizes;
 
-void PM_Startup()
+// decoded sprites and the spans they point to
+spriteshape_t *PMSpriteShapes;
+spritespan_t *PMSpriteSpans;
+
+/*
+=============================================================================
+
+                             PAGE RESIDENCY
+
+With --pagebudget, pages are only loaded on their first use and PMPages
+holds NULL for pages not in memory. All pages used since the last call of
+PM_NextFrame are pinned, older pages are freed in least recently used
+order, when the loaded pages exceed the budget.
+
+Without a budget the pages aren't tracked, so PM_GetPage costs nothing more
+than the bounds check.
+
+=============================================================================
+*/
+
+uint32_t *PMPageFrames;             // frame of the last use of every page, NULL if not tracked
+uint32_t PMFrame;
+
+static FILE *PMFile;
+static uint32_t *PMPageOffsets;
+static int *PMPageNext, *PMPagePrev;    // resident pages from least to most recently used
+static int PMLRUHead = -1, PMLRUTail = -1;
+static uint32_t PMResident, PMPeakResident;
+static uint32_t PMPageHits, PMPageMisses, PMPageEvictions;
+static uint8_t *PMRunBuffer;
+static uint32_t PMRunBufferSize;
+static uint8_t PMEmptyPage[4];
+static SDL_mutex *PMPageMutex;      // render threads and the prefetcher may load pages concurrently
+
+//
+// prefetcher
+//
+#define PF_NONE     0
+#define PF_QUEUED   1
+#define PF_WARMED   2               // loaded by the prefetcher and not used since
+
+static byte *PMPrefetchState;       // PF_* of every page, NULL without prefetching
+static int *PMPrefetchList;
+static int PMPrefetchCount;
+static SDL_Thread *PMPrefetchThread;
+static bool PMPrefetchStop;         // PMPrefetchStop and PMPrefetchDone are guarded by PMPageMutex
+static int PMPrefetchDone;
+static uint32_t PMPrefetchLevels, PMPrefetchQueued, PMPrefetchWarmed, PMPrefetchBytes;
+static uint32_t PMPrefetchHits, PMPrefetchUnfinished;
+
+static void PM_UnlinkPage(int page)
 {
-    char fname[13] = "vswap.";
-    strcat(fname,extension);
+    if(PMPagePrev[page] >= 0) PMPageNext[PMPagePrev[page]] = PMPageNext[page];
+    else PMLRUHead = PMPageNext[page];
+    if(PMPageNext[page] >= 0) PMPagePrev[PMPageNext[page]] = PMPagePrev[page];
+    else PMLRUTail = PMPagePrev[page];
+}
 
-    FILE *file = fopen(fname,"rb");
-    if(!file)
-        CA_CannotOpen(fname);
+static void PM_LinkPage(int page)
+{
+    PMPagePrev[page] = PMLRUTail;
+    PMPageNext[page] = -1;
+    if(PMLRUTail >= 0) PMPageNext[PMLRUTail] = page;
+    else PMLRUHead = page;
+    PMLRUTail = page;
+}
 
-    ChunksInFile = 0;
-    fread(&ChunksInFile, sizeof(word), 1, file);
-    PMSpriteStart = 0;
-    fread(&PMSpriteStart, sizeof(word), 1, file);
-    PMSoundStart = 0;
-    fread(&PMSoundStart, sizeof(word), 1, file);
+/*
+===================
+=
+= PM_LoadPage
+=
+===================
+*/
 
-    uint32_t* pageOffsets = (uint32_t *) malloc((ChunksInFile + 1) * sizeof(int32_t));
-    CHECKMALLOCRESULT(pageOffsets);
-    fread(pageOffsets, sizeof(uint32_t), ChunksInFile, file);
+static void PM_LoadPage(int page)
+{
+    uint32_t size = PMPageSizes[page];
+    uint8_t *ptr;
 
-    word *pageLengths = (word *) malloc(ChunksInFile * sizeof(word));
-    CHECKMALLOCRESULT(pageLengths);
-    fread(pageLengths, sizeof(word), ChunksInFile, file);
+    if(!size)
+    {
+        PMPages[page] = PMEmptyPage;    // sparse page
+        return;
+    }
 
-    fseek(file, 0, SEEK_END);
-    long fileSize = ftell(file);
-    long pageDataSize = fileSize - pageOffsets[0];
-    if(pageDataSize > (size_t) -1)
-        Quit("The page file \"%s\" is too large!", fname);
+    ptr = (uint8_t *) malloc(size);
+    CHECKMALLOCRESULT(ptr);
+#ifdef PM_MAPPAGES
+    if(pread(fileno(PMFile), ptr, size, PMPageOffsets[page]) != (ssize_t) size)
+#else
+    if(fseek(PMFile, PMPageOffsets[page], SEEK_SET)
+        || fread(ptr, 1, size, PMFile) != size)
+#endif
+        Quit("PM_LoadPage: Unable to read page %i!", page);
 
-    pageOffsets[ChunksInFile] = fileSize;
+    PMPages[page] = ptr;
+    PMResident += size;
+    if(PMResident > PMPeakResident)
+        PMPeakResident = PMResident;
+}
 
-    uint32_t dataStart = pageOffsets[0];
+/*
+===================
+=
+= PM_TouchPage
+=
+= Called by PM_GetPage for the first use of a page in the current frame.
+= Loads the page, if it isn't resident, and marks it most recently used.
+=
+===================
+*/
+
+void PM_TouchPage(int page)
+{
+    SDL_LockMutex(PMPageMutex);
+    if(PMPageFrames[page] != PMFrame)
+    {
+        if(PMPrefetchState && PMPrefetchState[page] == PF_WARMED)
+        {
+            PMPrefetchState[page] = PF_NONE;
+            PMPrefetchHits++;
+        }
+        if(!PMPages[page])
+        {
+            PM_LoadPage(page);
+            PMPageMisses++;
+        }
+        else
+        {
+            if(PMPages[page] != PMEmptyPage)
+                PM_UnlinkPage(page);
+            PMPageHits++;
+        }
+        if(PMPages[page] != PMEmptyPage)
+            PM_LinkPage(page);
+        PMPageFrames[page] = PMFrame;
+    }
+    SDL_UnlockMutex(PMPageMutex);
+}
+
+/*
+===================
+=
+= PM_NextFrame
+=
+= Frees the least recently used pages not used in the current frame until
+= the resident pages fit into the budget and starts a new frame
+=
+===================
+*/
+
+void PM_NextFrame()
+{
+    uint32_t budget = (uint32_t) param_pagebudget * 1024;
+    int page;
+
+    if(!PMPageFrames)
+        return;
+
+    SDL_LockMutex(PMPageMutex);
+    while(PMResident > budget && PMLRUHead >= 0 && PMPageFrames[PMLRUHead] != PMFrame)
+    {
+        page = PMLRUHead;
+        PM_UnlinkPage(page);
+        free(PMPages[page]);
+        PMPages[page] = NULL;
+        PMResident -= PMPageSizes[page];
+        PMPageEvictions++;
+    }
+    PMFrame++;
+    SDL_UnlockMutex(PMPageMutex);
+}
+
+/*
+===================
+=
+= PM_GetPageRun
+=
+= Returns size bytes starting at the given page, which may reach over the
+= following pages, or NULL if they reach the end of the page file
+=
+===================
+*/
+
+uint8_t *PM_GetPageRun(int page, uint32_t size)
+{
+    uint32_t avail, done, n;
     int i;
 
-    // Check that all pageOffsets are valid
-    for(i = 0; i < ChunksInFile; i++)
+    if(!PMFile)
     {
-        if(!pageOffsets[i]) continue;   // sparse page
-        if(pageOffsets[i] < dataStart || pageOffsets[i] >= (size_t) fileSize)
-            Quit("Illegal page offset for page %i: %u (filesize: %u)",
-                    i, pageOffsets[i], fileSize);
+        uint8_t *ptr = PM_GetPage(page);
+        return size >= (uint32_t) (PM_GetEnd() - ptr) ? NULL : ptr;
+    }
+
+    for(avail = 0, i = page; i < ChunksInFile; i++)
+        avail += PMPageSizes[i];
+    if(size >= avail)
+        return NULL;
+
+    if(size > PMRunBufferSize)
+    {
+        free(PMRunBuffer);
+        PMRunBuffer = (uint8_t *) malloc(size);
+        CHECKMALLOCRESULT(PMRunBuffer);
+        PMRunBufferSize = size;
+    }
+    for(done = 0, i = page; done < size; i++)
+    {
+        n = PMPageSizes[i] < size - done ? PMPageSizes[i] : size - done;
+        memcpy(PMRunBuffer + done, PM_GetPage(i), n);
+        done += n;
+    }
+    return PMRunBuffer;
+}
+
+/*
+=============================================================================
+
+                               PREFETCHER
+
+The pages a level will need are queued with PM_PrefetchPage when it is set
+up. PM_StartPrefetch loads them on a worker thread while the level start
+screens are shown, PM_FinishPrefetch stops it before the first frame.
+Pages of a mapped page file are faulted in by reading them, with a page
+budget they are loaded like on first use, as long as they fit the budget.
+
+=============================================================================
+*/
+
+/*
+===================
+=
+= PM_PrefetchPage
+=
+===================
+*/
+
+void PM_PrefetchPage(int page)
+{
+    if(!PMPrefetchState || page < 0 || page >= ChunksInFile || PMPrefetchThread)
+        return;
+    if(PMPrefetchState[page] == PF_QUEUED || !PMPageSizes[page])
+        return;
+
+    PMPrefetchState[page] = PF_QUEUED;
+    PMPrefetchList[PMPrefetchCount++] = page;
+}
+
+/*
+===================
+=
+= PM_PrefetchThread
+=
+===================
+*/
+
+static int PM_PrefetchThread(void *)
+{
+    uint32_t budget = (uint32_t) param_pagebudget * 1024;
+    uint32_t size, ofs;
+    volatile uint8_t sum = 0;
+    uint8_t *ptr;
+    bool warmed;
+    int i, page;
+
+    for(i = 0; ; i++)
+    {
+        SDL_LockMutex(PMPageMutex);
+        PMPrefetchDone = i;
+        if(i == PMPrefetchCount || PMPrefetchStop)
+        {
+            SDL_UnlockMutex(PMPageMutex);
+            break;
+        }
+
+        page = PMPrefetchList[i];
+        size = PMPageSizes[page];
+        warmed = false;
+
+        if(PMFile)
+        {
+            if(PMResident + size > budget)
+                PMPrefetchStop = true;
+            else if(!PMPages[page])
+            {
+                PM_LoadPage(page);
+                PM_LinkPage(page);
+                PMPageFrames[page] = PMFrame - 1;   // not pinned, the next use counts
+                warmed = true;
+            }
+        }
+        else
+        {
+            // touch every memory page to fault it in, the mapping needs no lock
+            SDL_UnlockMutex(PMPageMutex);
+            ptr = PMPages[page];
+            for(ofs = 0; ofs < size; ofs += 4096)
+                sum += ptr[ofs];
+            sum += ptr[size - 1];
+            warmed = true;
+            SDL_LockMutex(PMPageMutex);
+        }
+
+        PMPrefetchState[page] = warmed ? PF_WARMED : PF_NONE;
+        if(warmed)
+        {
+            PMPrefetchWarmed++;
+            PMPrefetchBytes += size;
+        }
+        SDL_UnlockMutex(PMPageMutex);
+    }
+    return 0;
+}
+
+/*
+===================
+=
+= PM_StartPrefetch
+=
+===================
+*/
+
+void PM_StartPrefetch()
+{
+    if(!PMPrefetchState || PMPrefetchThread || !PMPrefetchCount)
+        return;
+
+    PMPrefetchLevels++;
+    PMPrefetchQueued += PMPrefetchCount;
+    PMPrefetchStop = false;
+    PMPrefetchDone = 0;
+    PMPrefetchThread = SDL_CreateThread(PM_PrefetchThread, NULL);
+    if(!PMPrefetchThread)
+        PM_FinishPrefetch();        // just load the pages on first use
+}
+
+/*
+===================
+=
+= PM_FinishPrefetch
+=
+= Stops the prefetcher, if it hasn't finished yet
+=
+===================
+*/
+
+void PM_FinishPrefetch()
+{
+    int i;
+
+    if(PMPrefetchThread)
+    {
+        SDL_LockMutex(PMPageMutex);
+        PMPrefetchStop = true;
+        SDL_UnlockMutex(PMPageMutex);
+        SDL_WaitThread(PMPrefetchThread, NULL);
+        PMPrefetchThread = NULL;
+    }
+
+    for(i = PMPrefetchDone; i < PMPrefetchCount; i++)
+    {
+        if(PMPrefetchState[PMPrefetchList[i]] == PF_QUEUED)
+            PMPrefetchState[PMPrefetchList[i]] = PF_NONE;
+        PMPrefetchUnfinished++;
+    }
+    PMPrefetchCount = PMPrefetchDone = 0;
+}
+
+/*
+===================
+=
+= PM_DecodeSprite
+=
+= Decodes the column posts of a sprite page into spans. When spans is NULL,
+= they are only counted. Posts reaching outside of the page are dropped.
+= Returns the number of spans.
+=
+===================
+*/
+
+static int PM_DecodeSprite(int shapenum, spriteshape_t *sprite, spritespan_t *spans)
+{
+    byte *shape = PM_GetPage(PMSpriteStart + shapenum);
+    int32_t size = (int32_t) PM_GetPageSize(PMSpriteStart + shapenum);
+    byte *ptr, *line, *end;
+    word leftpix, rightpix, endy, starty, ofs;
+    short newstart;
+    int i, count = 0;
+
+    sprite->leftpix = 1;                // empty, until proven otherwise
+    sprite->rightpix = 0;
+    sprite->top = PMSpriteSize;
+    sprite->bottom = 0;
+    if(size < 4)
+        return 0;                       // sparse page
+
+    ptr = shape;
+    leftpix = READWORD(ptr);
+    rightpix = READWORD(ptr);
+    if(leftpix > rightpix || rightpix >= PMSpriteSize
+            || 4 + (rightpix - leftpix + 1) * 2 > size)
+        return 0;
+
+    sprite->leftpix = leftpix;
+    sprite->rightpix = rightpix;
+
+    end = shape + size;
+    for(i = 0; i <= rightpix - leftpix; i++)
+    {
+        if(spans) sprite->columns[i] = spans + count;
+
+        ofs = READWORD(ptr);
+        line = shape + ofs;
+        while(line + 2 <= end && (endy = READWORD(line)) != 0)
+        {
+            if(line + 4 > end)
+                break;
+            endy >>= 1;
+            newstart = (short) READWORD(line);
+            starty = READWORD(line) >> 1;
+            if(starty >= endy)
+                continue;                           // nothing to draw
+            if(newstart + starty < 0 || newstart + endy > size)
+                continue;                           // broken post
+
+            if(spans)
+            {
+                spans[count].start = starty;
+                spans[count].end = endy;
+                spans[count].texofs = newstart;
+            }
+            if(starty < sprite->top) sprite->top = starty;
+            if(endy > sprite->bottom) sprite->bottom = endy;
+            count++;
+        }
+    }
+    if(spans) sprite->columns[i] = spans + count;
+
+    return count;
+}
+
+#ifndef NDEBUG
+
+/*
+===================
+=
+= PM_CheckSprite
+=
+= Draws a sprite unscaled once from its command stream like the original
+= scalers did and once from its spans and quits if the pictures differ
+=
+===================
+*/
+
+static void PM_CheckSprite(int shapenum)
+{
+    static word pic[2][PMSpriteSize * PMSpriteSize];
+    t_compshape *shape = (t_compshape *) PM_GetSprite(shapenum);
+    spriteshape_t *sprite = &PMSpriteShapes[shapenum];
+    int32_t size = (int32_t) PM_GetPageSize(PMSpriteStart + shapenum);
+    spritespan_t *span;
+    byte *line;
+    word endy, starty;
+    short newstart;
+    int i, j;
+
+    memset(pic, 0xff, sizeof(pic));     // 0xffff is transparent
+
+    if(size >= 4 && shape->leftpix <= shape->rightpix && shape->rightpix < PMSpriteSize)
+    {
+        for(i = shape->leftpix; i <= shape->rightpix; i++)
+        {
+            line = (byte *) shape + shape->dataofs[i - shape->leftpix];
+            while((endy = READWORD(line)) != 0)
+            {
+                endy >>= 1;
+                newstart = READWORD(line);
+                starty = READWORD(line) >> 1;
+                for(j = starty; j < endy && j < PMSpriteSize; j++)
+                    pic[0][j * PMSpriteSize + i] = ((byte *) shape)[newstart + j];
+            }
+        }
+    }
+
+    for(i = sprite->leftpix; i <= sprite->rightpix; i++)
+    {
+        for(span = sprite->columns[i - sprite->leftpix];
+                span < sprite->columns[i - sprite->leftpix + 1]; span++)
+        {
+            for(j = span->start; j < span->end && j < PMSpriteSize; j++)
+                pic[1][j * PMSpriteSize + i] = ((byte *) shape)[span->texofs + j];
+        }
+    }
+
+    if(memcmp(pic[0], pic[1], sizeof(pic[0])))
+        Quit("PM_CheckSprite: Decoded sprite %i differs from the original!", shapenum);
+}
+
+#endif
+
+/*
+===================
+=
+= PM_DecodeSprites
+=
+===================
+*/
+
+static void PM_DecodeSprites()
+{
+    int numsprites = PMSoundStart - PMSpriteStart;
+    int i, numspans = 0;
+
+    PMSpriteShapes = (spriteshape_t *) malloc(numsprites * sizeof(spriteshape_t));
+    CHECKMALLOCRESULT(PMSpriteShapes);
+
+    for(i = 0; i < numsprites; i++)
+    {
+        numspans += PM_DecodeSprite(i, &PMSpriteShapes[i], NULL);
+        PM_NextFrame();
+    }
+
+    PMSpriteSpans = (spritespan_t *) malloc((numspans ? numspans : 1) * sizeof(spritespan_t));
+    CHECKMALLOCRESULT(PMSpriteSpans);
+
+    for(i = 0, numspans = 0; i < numsprites; i++)
+    {
+        numspans += PM_DecodeSprite(i, &PMSpriteShapes[i], PMSpriteSpans + numspans);
+#ifndef NDEBUG
+        PM_CheckSprite(i);
+#endif
+        PM_NextFrame();             // keep the pages within the budget
     }
+}
+
+/*
+===================
+=
+= PM_ReadPages
+=
+= Reads all pages into one buffer, padding the sprite pages and the sound
+= info page to 2-byte alignment
+=
+===================
+*/
+
+static void PM_ReadPages(FILE *file, uint32_t *pageOffsets, word *pageLengths, long pageDataSize)
+{
+    uint32_t dataStart = pageOffsets[0];
+    int i;
 
     // Calculate total amount of padding needed for sprites and sound info page
     int alignPadding = 0;
@@ -75,9 +599,6 @@ void PM_Startup()
     PMPageData = (uint32_t *) malloc(PMPageDataSize);
     CHECKMALLOCRESULT(PMPageData);
 
-    PMPages = (uint8_t **) malloc((ChunksInFile + 1) * sizeof(uint8_t *));
-    CHECKMALLOCRESULT(PMPages);
-
     // Load pages and initialize PMPages pointers
     uint8_t *ptr = (uint8_t *) PMPageData;
     for(i = 0; i < ChunksInFile; i++)
@@ -113,13 +634,298 @@ void PM_Startup()
     // last page points after page buffer
     PMPages[ChunksInFile] = ptr;
 
-    free(pageLengths);
-    free(pageOffsets);
-    fclose(file);
+    // the padding in front of a page is counted to the page before it
+    for(i = 0; i < ChunksInFile; i++)
+        PMPageSizes[i] = (uint32_t) (PMPages[i + 1] - PMPages[i]);
+}
+
+/*
+===================
+=
+= PM_FilePageSize
+=
+= Returns the size of a page in the page file
+=
+===================
+*/
+
+static uint32_t PM_FilePageSize(int i, uint32_t *pageOffsets, word *pageLengths, long fileSize)
+{
+    uint32_t size;
+
+    if(!pageOffsets[i]) return 0;   // sparse page
+
+    // Use specified page length, when next page is sparse page.
+    // Otherwise, calculate size from the offset difference between this and the next page.
+    if(!pageOffsets[i + 1]) size = pageLengths[i];
+    else size = pageOffsets[i + 1] - pageOffsets[i];
+    if(size > (uint32_t) fileSize - pageOffsets[i])
+        Quit("Illegal page size for page %i: %u (filesize: %u)", i, size, fileSize);
+    return size;
+}
+
+/*
+===================
+=
+= PM_StartPaging
+=
+= Keeps the page file open to load the pages on demand, takes over
+= pageOffsets
+=
+===================
+*/
+
+static void PM_StartPaging(FILE *file, uint32_t *pageOffsets, word *pageLengths, long fileSize)
+{
+    int i;
+
+    PMFile = file;
+    PMPageOffsets = pageOffsets;
+
+    // track the first use of every page per frame
+    PMPageFrames = (uint32_t *) malloc((ChunksInFile ? ChunksInFile : 1) * sizeof(uint32_t));
+    CHECKMALLOCRESULT(PMPageFrames);
+    memset(PMPageFrames, 0xff, (ChunksInFile ? ChunksInFile : 1) * sizeof(uint32_t));
+    PMFrame = 0;
+    PMPageNext = (int *) malloc((ChunksInFile ? ChunksInFile : 1) * sizeof(int));
+    CHECKMALLOCRESULT(PMPageNext);
+    PMPagePrev = (int *) malloc((ChunksInFile ? ChunksInFile : 1) * sizeof(int));
+    CHECKMALLOCRESULT(PMPagePrev);
+
+    for(i = 0; i < ChunksInFile; i++)
+    {
+        PMPageSizes[i] = PM_FilePageSize(i, pageOffsets, pageLengths, fileSize);
+        PMPages[i] = NULL;
+    }
+    PMPages[ChunksInFile] = NULL;
+}
+
+#ifdef PM_MAPPAGES
+
+/*
+===================
+=
+= PM_MapPages
+=
+= Maps the page file read-only and points PMPages into the mapping, so
+= pages are only loaded when they are touched. Only the sprite pages and
+= the sound info page at odd offsets are copied to get 2-byte alignment.
+= Returns false, if the file can't be mapped.
+=
+===================
+*/
+
+static bool PM_MapPages(FILE *file, uint32_t *pageOffsets, word *pageLengths, long fileSize)
+{
+    uint32_t alignedSize;
+    uint8_t *ptr, *aligned;
+    int i;
+
+    PMMapping = (uint8_t *) mmap(NULL, (size_t) fileSize, PROT_READ, MAP_SHARED, fileno(file), 0);
+    if(PMMapping == (uint8_t *) MAP_FAILED)
+    {
+        PMMapping = NULL;
+        return false;
+    }
+    PMMappingSize = (size_t) fileSize;
+
+    // size the side buffer for the misaligned pages
+    alignedSize = 0;
+    for(i = 0; i < ChunksInFile; i++)
+    {
+        PMPageSizes[i] = PM_FilePageSize(i, pageOffsets, pageLengths, fileSize);
+        if(PMPageSizes[i] && (pageOffsets[i] & 1)
+            && ((i >= PMSpriteStart && i < PMSoundStart) || i == ChunksInFile - 1))
+            alignedSize += (PMPageSizes[i] + 1) & ~1;
+    }
+
+    if(alignedSize)
+    {
+        PMAlignedPages = (uint8_t *) malloc(alignedSize);
+        CHECKMALLOCRESULT(PMAlignedPages);
+    }
+
+    ptr = PMMapping + pageOffsets[0];
+    aligned = PMAlignedPages;
+    for(i = 0; i < ChunksInFile; i++)
+    {
+        if(!pageOffsets[i])
+        {
+            PMPages[i] = ptr;       // sparse page
+            continue;
+        }
+
+        ptr = PMMapping + pageOffsets[i];
+        if((pageOffsets[i] & 1) && ((i >= PMSpriteStart && i < PMSoundStart) || i == ChunksInFile - 1))
+        {
+            memcpy(aligned, ptr, PMPageSizes[i]);
+            PMPages[i] = aligned;
+            aligned += (PMPageSizes[i] + 1) & ~1;
+        }
+        else
+            PMPages[i] = ptr;
+        ptr += PMPageSizes[i];
+    }
+
+    // sounds may reach over several pages up to the end of the file
+    PMPages[ChunksInFile] = PMMapping + fileSize;
+
+    return true;
+}
+
+#endif
+
+void PM_Startup()
+{
+    char fname[13] = "vswap.";
+    strcat(fname,extension);
+
+    FILE *file = fopen(fname,"rb");
+    if(!file)
+        CA_CannotOpen(fname);
+
+    ChunksInFile = 0;
+    fread(&ChunksInFile, sizeof(word), 1, file);
+    PMSpriteStart = 0;
+    fread(&PMSpriteStart, sizeof(word), 1, file);
+    PMSoundStart = 0;
+    fread(&PMSoundStart, sizeof(word), 1, file);
+
+    uint32_t* pageOffsets = (uint32_t *) malloc((ChunksInFile + 1) * sizeof(int32_t));
+    CHECKMALLOCRESULT(pageOffsets);
+    fread(pageOffsets, sizeof(uint32_t), ChunksInFile, file);
+
+    word *pageLengths = (word *) malloc(ChunksInFile * sizeof(word));
+    CHECKMALLOCRESULT(pageLengths);
+    fread(pageLengths, sizeof(word), ChunksInFile, file);
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    long pageDataSize = fileSize - pageOffsets[0];
+    if(pageDataSize > (size_t) -1)
+        Quit("The page file \"%s\" is too large!", fname);
+
+    pageOffsets[ChunksInFile] = fileSize;
+
+    uint32_t dataStart = pageOffsets[0];
+    int i;
+
+    // Check that all pageOffsets are valid
+    for(i = 0; i < ChunksInFile; i++)
+    {
+        if(!pageOffsets[i]) continue;   // sparse page
+        if(pageOffsets[i] < dataStart || pageOffsets[i] >= (size_t) fileSize)
+            Quit("Illegal page offset for page %i: %u (filesize: %u)",
+                    i, pageOffsets[i], fileSize);
+    }
+
+    PMPages = (uint8_t **) malloc((ChunksInFile + 1) * sizeof(uint8_t *));
+    CHECKMALLOCRESULT(PMPages);
+    PMPageSizes = (uint32_t *) malloc((ChunksInFile ? ChunksInFile : 1) * sizeof(uint32_t));
+    CHECKMALLOCRESULT(PMPageSizes);
+
+    bool mapped = false;
+
+    if(param_pagebudget)
+    {
+        PM_StartPaging(file, pageOffsets, pageLengths, fileSize);
+        free(pageLengths);
+    }
+    else
+    {
+#ifdef PM_MAPPAGES
+        mapped = param_mappages && PM_MapPages(file, pageOffsets, pageLengths, fileSize);
+        if(!mapped)
+#endif
+            PM_ReadPages(file, pageOffsets, pageLengths, pageDataSize);
+
+        free(pageLengths);
+        free(pageOffsets);
+        fclose(file);
+    }
+
+    // prefetching only helps, if the pages aren't all read already
+    if(param_prefetch && (PMFile || mapped))
+    {
+        PMPrefetchState = (byte *) calloc(ChunksInFile ? ChunksInFile : 1, 1);
+        CHECKMALLOCRESULT(PMPrefetchState);
+        PMPrefetchList = (int *) malloc((ChunksInFile ? ChunksInFile : 1) * sizeof(int));
+        CHECKMALLOCRESULT(PMPrefetchList);
+    }
+
+    if(PMFile || PMPrefetchState)
+    {
+        PMPageMutex = SDL_CreateMutex();
+        if(!PMPageMutex)
+            Quit("Unable to create the page mutex: %s", SDL_GetError());
+    }
+
+    PM_DecodeSprites();
 }
 
 void PM_Shutdown()
 {
+    if(PMPrefetchState)
+    {
+        PM_FinishPrefetch();
+        if(PMPrefetchLevels)
+        {
+            printf("prefetch: %u levels, %u pages queued, %u warmed (%u KB), %u unfinished\n",
+                PMPrefetchLevels, PMPrefetchQueued, PMPrefetchWarmed, PMPrefetchBytes / 1024,
+                PMPrefetchUnfinished);
+            if(PMFile)              // only counted for tracked pages
+                printf("prefetch: %u warmed pages used\n", PMPrefetchHits);
+        }
+        free(PMPrefetchState);
+        free(PMPrefetchList);
+        PMPrefetchState = NULL;
+        PMPrefetchList = NULL;
+    }
+
+    if(PMFile)
+    {
+        if(PMPageHits + PMPageMisses)
+        {
+            printf("pagebudget: %i KB, %u hits, %u misses, %u evictions, peak %u KB\n",
+                param_pagebudget, PMPageHits, PMPageMisses, PMPageEvictions,
+                PMPeakResident / 1024);
+        }
+        for(int i = 0; i < ChunksInFile; i++)
+        {
+            if(PMPages[i] != PMEmptyPage)
+                free(PMPages[i]);
+        }
+        free(PMPageNext);
+        free(PMPagePrev);
+        free(PMPageOffsets);
+        free(PMRunBuffer);
+        fclose(PMFile);
+        PMFile = NULL;
+        PMPageOffsets = NULL;
+        PMRunBuffer = NULL;
+        PMRunBufferSize = 0;
+        PMLRUHead = PMLRUTail = -1;
+        PMResident = 0;
+    }
+    if(PMPageMutex)
+    {
+        free(PMPageFrames);
+        SDL_DestroyMutex(PMPageMutex);
+        PMPageFrames = NULL;
+        PMPageMutex = NULL;
+    }
+
+    free(PMSpriteSpans);
+    free(PMSpriteShapes);
+    free(PMPageSizes);
     free(PMPages);
     free(PMPageData);
+    PMPageData = NULL;
+#ifdef PM_MAPPAGES
+    free(PMAlignedPages);
+    if(PMMapping)
+        munmap(PMMapping, PMMappingSize);
+    PMAlignedPages = NULL;
+    PMMapping = NULL;
+#endif
 }
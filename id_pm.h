@@ -3,34 +3,69 @@
 
 #ifdef USE_HIRES
 #define PMPageSize 16384
+#define PMSpriteSize 128
 #else
 #define PMPageSize 4096
+#define PMSpriteSize 64
 #endif
 
+//
+// PM_Startup decodes the column posts of every sprite page into spans, so
+// the scalers don't have to parse the command streams for every column
+//
+typedef struct
+{
+    word start, end;                // rows start to end-1 are drawn
+    short texofs;                   // texel of row y is at texofs+y in the sprite page
+} spritespan_t;
+
+typedef struct
+{
+    word leftpix, rightpix;         // first and last column, as in t_compshape
+    word top, bottom;               // all spans lie within rows top to bottom-1
+    spritespan_t *columns[PMSpriteSize + 1];    // spans of column leftpix+i are
+                                                // columns[i] to columns[i+1]-1
+} spriteshape_t;
+
 extern int ChunksInFile;
 extern int PMSpriteStart;
 extern int PMSoundStart;
 
 extern bool PMSoundInfoPagePadded;
 
+extern spriteshape_t *PMSpriteShapes;
+
 // ChunksInFile+1 pointers to page starts.
 // The last pointer points one byte after the last page.
 extern uint8_t **PMPages;
+extern uint32_t *PMPageSizes;        // ChunksInFile page sizes
+
+// frame of the last use of every page, NULL unless the page use is tracked
+extern uint32_t *PMPageFrames;
+extern uint32_t PMFrame;
 
 void PM_Startup();
 void PM_Shutdown();
+void PM_TouchPage(int page);
+void PM_NextFrame();
+uint8_t *PM_GetPageRun(int page, uint32_t size);
+void PM_PrefetchPage(int page);
+void PM_StartPrefetch();
+void PM_FinishPrefetch();
 
 static inline uint32_t PM_GetPageSize(int page)
 {
     if(page < 0 || page >= ChunksInFile)
         Quit("PM_GetPageSize: Tried to access illegal page: %i", page);
-    return (uint32_t) (PMPages[page + 1] - PMPages[page]);
+    return PMPageSizes[page];
 }
 
 static inline uint8_t *PM_GetPage(int page)
 {
     if(page < 0 || page >= ChunksInFile)
         Quit("PM_GetPage: Tried to access illegal page: %i", page);
+    if(PMPageFrames && PMPageFrames[page] != PMFrame)
+        PM_TouchPage(page);         // first use in this frame
     return PMPages[page];
 }
 
@@ -50,6 +85,13 @@ static inline uint16_t *PM_GetSprite(int shapenum)
     return (uint16_t *) (void *) PM_GetPage(PMSpriteStart + shapenum);
 }
 
+static inline spriteshape_t *PM_GetSpriteShape(int shapenum)
+{
+    if(shapenum < 0 || shapenum >= PMSoundStart - PMSpriteStart)
+        Quit("PM_GetSpriteShape: Tried to access illegal sprite: %i", shapenum);
+    return &PMSpriteShapes[shapenum];
+}
+
 static inline byte *PM_GetSound(int soundpagenum)
 {
     return PM_GetPage(PMSoundStart + soundpagenum);
@@ -547,8 +547,8 @@ void SD_PrepareSound(int which)
     int page = DigiList[which].startpage;
     int size = DigiList[which].length;
 
-    byte *origsamples = PM_GetSound(page);
-    if(origsamples + size >= PM_GetEnd())
+    byte *origsamples = PM_GetPageRun(PMSoundStart + page, size);
+    if(!origsamples)
         Quit("SD_PrepareSound(%i): Sound reaches out of page file!\n", which);
 
     int destsamples = (int) ((float) size * (float) param_samplerate
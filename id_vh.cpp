@@ -115,8 +115,7 @@ void VW_MeasurePropString (const char *string, word *width, word *height)
 
 void VH_UpdateScreen()
 {
-	SDL_BlitSurface(screenBuffer, NULL, screen, NULL);
-	SDL_Flip(screen);
+	VL_UpdateScreen(screenBuffer);
 }
 
 
@@ -308,8 +307,6 @@ static const uint32_t rndmasks[] = {
 static unsigned int rndbits_y;
 static unsigned int rndmask;
 
-extern SDL_Color curpal[256];
-
 // Returns the number of bits needed to represent the given value
 static int log2_ceil(uint32_t x)
 {
@@ -348,6 +345,7 @@ boolean FizzleFade (SDL_Surface *source, int x1, int y1,
     pixperframe = width * height / frames;
 
     IN_StartAck ();
+    VL_FlushPresent ();
 
     frame = GetTimeCount();
     byte *srcptr = VL_LockSurface(source);
@@ -356,8 +354,7 @@ boolean FizzleFade (SDL_Surface *source, int x1, int y1,
         if(abortable && IN_CheckAck ())
         {
             VL_UnlockSurface(source);
-            SDL_BlitSurface(source, NULL, screen, NULL);
-            SDL_Flip(screen);
+            VL_UpdateScreen(source);
             return true;
         }
 
@@ -404,7 +401,7 @@ boolean FizzleFade (SDL_Surface *source, int x1, int y1,
                 else
                 {
                     byte col = *(srcptr + (y1 + y) * source->pitch + x1 + x);
-                    uint32_t fullcol = SDL_MapRGB(screen->format, curpal[col].r, curpal[col].g, curpal[col].b);
+                    uint32_t fullcol = presentlut[col];
                     memcpy(destptr + (y1 + y) * screen->pitch + (x1 + x) * screen->format->BytesPerPixel,
                         &fullcol, screen->format->BytesPerPixel);
                 }
@@ -429,7 +426,6 @@ boolean FizzleFade (SDL_Surface *source, int x1, int y1,
 finished:
     VL_UnlockSurface(source);
     VL_UnlockSurface(screen);
-    SDL_BlitSurface(source, NULL, screen, NULL);
-    SDL_Flip(screen);
+    VL_UpdateScreen(source);
     return false;
 }
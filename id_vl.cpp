@@ -2,8 +2,14 @@
 
 #include <string.h>
 #include "wl_def.h"
+#include <SDL_thread.h>
 #pragma hdrstop
 
+#if defined(_M_IX86) || defined(__MMX__)
+#include <mmintrin.h>
+#define SCALEMMX
+#endif
+
 // Uncomment the following line, if you get destination out of bounds
 // assertion errors and want to ignore them during debugging
 //#define IGNORE_BAD_DEST
@@ -52,9 +58,16 @@ unsigned scaleFactor;
 boolean	 screenfaded;
 unsigned bordercolor;
 
+static byte *scalerow;              // one deplanarized row of a pic being scaled
+
 SDL_Color palette1[256], palette2[256];
 SDL_Color curpal[256];
 
+// On non 8-bit displays the palette is applied when presenting the screen
+// buffer, using the current palette converted to the screen format
+uint32_t  curlut[256];
+uint32_t *presentlut = curlut;
+
 
 #define CASSERT(x) extern int ASSERT_COMPILE[((x) != 0) * 2 - 1];
 #define RGB(r, g, b) {(r)*255/63, (g)*255/63, (b)*255/63, 0}
@@ -82,6 +95,7 @@ CASSERT(lengthof(gamepal) == 256)
 
 void	VL_Shutdown (void)
 {
+    VL_ShutdownPresentThread ();
 	//VL_SetTextMode ();
 }
 
@@ -124,6 +138,8 @@ void	VL_SetVGAPlaneMode (void)
 
     SDL_SetColors(screen, gamepal, 0, 256);
     memcpy(curpal, gamepal, sizeof(SDL_Color) * 256);
+    VL_BuildPaletteLUT(gamepal, curlut);
+    presentlut = curlut;
 
     screenBuffer = SDL_CreateRGBSurface(SDL_SWSURFACE, screenWidth,
         screenHeight, 8, 0, 0, 0, 0);
@@ -147,6 +163,19 @@ void	VL_SetVGAPlaneMode (void)
     CHECKMALLOCRESULT(pixelangle);
     wallheight = (int *) malloc(screenWidth * sizeof(int));
     CHECKMALLOCRESULT(wallheight);
+    scalerow = (byte *) malloc(screenWidth);
+    CHECKMALLOCRESULT(scalerow);
+#ifdef USE_COLUMNVIEW
+    columnbuffer = (byte *) malloc(screenWidth * ((screenHeight + 15) & ~15));
+    CHECKMALLOCRESULT(columnbuffer);
+#endif
+#ifdef USE_SPRITECOVERAGE
+    spritecoverage = (uint32_t *) malloc(screenWidth * ((screenHeight + 31) >> 5) * sizeof(uint32_t));
+    CHECKMALLOCRESULT(spritecoverage);
+#endif
+
+    if(param_asyncpresent)
+        VL_StartPresentThread();
 }
 
 /*
@@ -216,12 +245,17 @@ void VL_SetColor	(int color, int red, int green, int blue)
     curpal[color] = col;
 
     if(screenBits == 8)
+    {
+        VL_FlushPresent();
         SDL_SetPalette(screen, SDL_PHYSPAL, &col, color, 1);
+    }
     else
     {
-        SDL_SetPalette(curSurface, SDL_LOGPAL, &col, color, 1);
-        SDL_BlitSurface(curSurface, NULL, screen, NULL);
-        SDL_Flip(screen);
+        if(presentlut != curlut)
+            memcpy(curlut, presentlut, sizeof(curlut));
+        curlut[color] = SDL_MapRGB(screen->format, red, green, blue);
+        presentlut = curlut;
+        VL_UpdateScreen(curSurface);
     }
 }
 
@@ -258,15 +292,65 @@ void VL_SetPalette (SDL_Color *palette, bool forceupdate)
     memcpy(curpal, palette, sizeof(SDL_Color) * 256);
 
     if(screenBits == 8)
+    {
+        VL_FlushPresent();
         SDL_SetPalette(screen, SDL_PHYSPAL, palette, 0, 256);
+    }
     else
     {
-        SDL_SetPalette(curSurface, SDL_LOGPAL, palette, 0, 256);
+        VL_BuildPaletteLUT(palette, curlut);
+        presentlut = curlut;
         if(forceupdate)
-        {
-            SDL_BlitSurface(curSurface, NULL, screen, NULL);
-            SDL_Flip(screen);
-        }
+            VL_UpdateScreen(curSurface);
+    }
+}
+
+/*
+=================
+=
+= VL_SetPaletteLUT
+=
+= Like VL_SetPalette, but uses a LUT already built by VL_BuildPaletteLUT
+= for the palette, which must stay valid while it is in use
+=
+=================
+*/
+
+void VL_SetPaletteLUT (SDL_Color *palette, uint32_t *lut, bool forceupdate)
+{
+    memcpy(curpal, palette, sizeof(SDL_Color) * 256);
+
+    if(screenBits == 8)
+    {
+        VL_FlushPresent();
+        SDL_SetPalette(screen, SDL_PHYSPAL, palette, 0, 256);
+    }
+    else
+    {
+        presentlut = lut;
+        if(forceupdate)
+            VL_UpdateScreen(curSurface);
+    }
+}
+
+/*
+=================
+=
+= VL_BuildPaletteLUT
+=
+= Converts the palette to pixel values of the screen format
+=
+=================
+*/
+
+void VL_BuildPaletteLUT (SDL_Color *palette, uint32_t *lut)
+{
+    for(int i=0; i<256; i++)
+    {
+        if(screenBits == 8)
+            lut[i] = i;
+        else
+            lut[i] = SDL_MapRGB(screen->format, palette[i].r, palette[i].g, palette[i].b);
     }
 }
 
@@ -287,6 +371,146 @@ void VL_GetPalette (SDL_Color *palette)
 }
 
 
+//===========================================================================
+
+// The nearest color search divides the RGB cube into 32x32x32 cells of
+// 8x8x8 colors. The first search in a cell collects the palette colors,
+// which can be the nearest one for any color of the cell: all colors not
+// farther from the cell than the farthest corner of the cell is from the
+// color closest to it. Later searches in the cell only compare those.
+// The cells are kept until VL_SetFindColorPalette gets another palette.
+#define CELLBITS    5
+#define CELLSIZE    (1 << (8 - CELLBITS))
+#define NUMCELLS    (1 << (3 * CELLBITS))
+
+static SDL_Color cellpal[256];              // palette the cells were built for
+static uint32_t *cellstart;                 // candidate list offset + 1, 0 if not built yet
+static byte     *cellpool;                  // per cell: count - 1, then the candidates
+static uint32_t  cellpoolsize, cellpoolused;
+
+static inline int ChannelDist(int value, int low)
+{
+    if(value < low) return low - value;
+    if(value >= low + CELLSIZE) return value - (low + CELLSIZE - 1);
+    return 0;
+}
+
+static inline int ChannelFar(int value, int low)
+{
+    int tolow = value - low, tohigh = low + CELLSIZE - 1 - value;
+    if(tolow < 0) tolow = -tolow;
+    if(tohigh < 0) tohigh = -tohigh;
+    return tolow > tohigh ? tolow : tohigh;
+}
+
+static uint32_t BuildColorCell(int cell)
+{
+    SDL_Color *palette = cellpal;
+    int lowr = (cell >> (2 * CELLBITS)) * CELLSIZE;
+    int lowg = ((cell >> CELLBITS) & ((1 << CELLBITS) - 1)) * CELLSIZE;
+    int lowb = (cell & ((1 << CELLBITS) - 1)) * CELLSIZE;
+    int mindist[256], bound = 0x7fffffff;
+    int col, d, count;
+
+    for(col = 0; col < 256; col++)
+    {
+        SDL_Color *c = &palette[col];
+        d = ChannelDist(c->r, lowr);
+        mindist[col] = d * d;
+        d = ChannelDist(c->g, lowg);
+        mindist[col] += d * d;
+        d = ChannelDist(c->b, lowb);
+        mindist[col] += d * d;
+
+        int far = ChannelFar(c->r, lowr) * ChannelFar(c->r, lowr)
+            + ChannelFar(c->g, lowg) * ChannelFar(c->g, lowg)
+            + ChannelFar(c->b, lowb) * ChannelFar(c->b, lowb);
+        if(far < bound) bound = far;
+    }
+
+    if(cellpoolused + 257 > cellpoolsize)
+    {
+        cellpoolsize = cellpoolsize ? cellpoolsize * 2 : 65536;
+        cellpool = (byte *) realloc(cellpool, cellpoolsize);
+        CHECKMALLOCRESULT(cellpool);
+    }
+
+    byte *list = cellpool + cellpoolused;
+    for(col = 0, count = 0; col < 256; col++)
+        if(mindist[col] <= bound)
+            list[1 + count++] = (byte) col;
+    list[0] = (byte) (count - 1);
+
+    cellstart[cell] = cellpoolused + 1;
+    cellpoolused += 1 + count;
+    return cellstart[cell];
+}
+
+/*
+=================
+=
+= VL_SetFindColorPalette
+=
+= Sets the palette VL_FindColor searches, call it before a batch of lookups
+=
+=================
+*/
+
+void VL_SetFindColorPalette (SDL_Color *palette)
+{
+    if(!cellstart)
+    {
+        cellstart = (uint32_t *) malloc(NUMCELLS * sizeof(uint32_t));
+        CHECKMALLOCRESULT(cellstart);
+    }
+    else if(!memcmp(cellpal, palette, sizeof(cellpal)))
+        return;
+
+    memset(cellstart, 0, NUMCELLS * sizeof(uint32_t));
+    memcpy(cellpal, palette, sizeof(cellpal));
+    cellpoolused = 0;
+}
+
+/*
+=================
+=
+= VL_FindColor
+=
+= Returns the palette index of the nearest matching color of the given
+= RGB color in the palette set by VL_SetFindColorPalette (the lowest one
+= on ties)
+=
+=================
+*/
+
+byte VL_FindColor (byte red, byte green, byte blue)
+{
+    int cell = ((red >> (8 - CELLBITS)) << (2 * CELLBITS))
+        | ((green >> (8 - CELLBITS)) << CELLBITS) | (blue >> (8 - CELLBITS));
+    uint32_t start = cellstart[cell];
+    if(!start)
+        start = BuildColorCell(cell);
+
+    byte *list = cellpool + start - 1;
+    int count = list[0] + 1;
+    byte mincol = list[1];
+    int mindist = 0x7fffffff;
+
+    for(int i = 1; i <= count; i++)
+    {
+        SDL_Color *c = &cellpal[list[i]];
+        int dr = red - c->r, dg = green - c->g, db = blue - c->b;
+        int curdist = dr * dr + dg * dg + db * db;
+        if(curdist < mindist)
+        {
+            mindist = curdist;
+            mincol = list[i];
+        }
+    }
+    return mincol;
+}
+
+
 //===========================================================================
 
 /*
@@ -389,6 +613,372 @@ void VL_FadeIn (int start, int end, SDL_Color *palette, int steps)
 	screenfaded = false;
 }
 
+/*
+=============================================================================
+
+							PRESENTING
+
+=============================================================================
+*/
+
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+#define PACK16(first, second) ((first) | ((second) << 16))
+#else
+#define PACK16(first, second) (((first) << 16) | (second))
+#endif
+
+static void ConvertRow16 (byte *src, byte *dest, unsigned width, uint32_t *lut)
+{
+    uint32_t *dest32 = (uint32_t *) dest;
+
+    // four pixels per step, stored as two words
+    for(; width >= 4; width -= 4, src += 4, dest32 += 2)
+    {
+        dest32[0] = PACK16(lut[src[0]], lut[src[1]]);
+        dest32[1] = PACK16(lut[src[2]], lut[src[3]]);
+    }
+    Uint16 *dest16 = (Uint16 *) dest32;
+    while(width--)
+        *dest16++ = (Uint16) lut[*src++];
+}
+
+static void ConvertRow24 (byte *src, byte *dest, unsigned width, uint32_t *lut)
+{
+    while(width--)
+    {
+        uint32_t col = lut[*src++];
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+        dest[0] = (byte) col;
+        dest[1] = (byte) (col >> 8);
+        dest[2] = (byte) (col >> 16);
+#else
+        dest[0] = (byte) (col >> 16);
+        dest[1] = (byte) (col >> 8);
+        dest[2] = (byte) col;
+#endif
+        dest += 3;
+    }
+}
+
+static void ConvertRow32 (byte *src, byte *dest, unsigned width, uint32_t *lut)
+{
+    uint32_t *dest32 = (uint32_t *) dest;
+
+    for(; width >= 4; width -= 4, src += 4, dest32 += 4)
+    {
+        dest32[0] = lut[src[0]];
+        dest32[1] = lut[src[1]];
+        dest32[2] = lut[src[2]];
+        dest32[3] = lut[src[3]];
+    }
+    while(width--)
+        *dest32++ = lut[*src++];
+}
+
+/*
+=================
+=
+= ConvertScreen
+=
+= Copies the pixels to the locked screen, converting them with lut on non
+= 8-bit displays
+=
+=================
+*/
+
+static void ConvertScreen (byte *src, unsigned srcpitch, unsigned width,
+    unsigned height, uint32_t *lut)
+{
+    void (*convertrow) (byte *, byte *, unsigned, uint32_t *) = NULL;
+    switch(screen->format->BytesPerPixel)
+    {
+        case 1:  break;
+        case 2:  convertrow = ConvertRow16; break;
+        case 3:  convertrow = ConvertRow24; break;
+        default: convertrow = ConvertRow32; break;
+    }
+
+    if(width > (unsigned) screen->w) width = screen->w;
+    if(height > (unsigned) screen->h) height = screen->h;
+
+    byte *dest = VL_LockSurface(screen);
+    if(!dest)
+        return;
+
+    for(unsigned y=0; y<height; y++, src+=srcpitch, dest+=screen->pitch)
+    {
+        if(convertrow)
+            convertrow(src, dest, width, lut);
+        else
+            memcpy(dest, src, width);
+    }
+    VL_UnlockSurface(screen);
+}
+
+/*
+=================
+=
+= VL_UpdateScreen
+=
+= Presents an 8-bit surface of the screen size. On non 8-bit displays the
+= pixels are converted with the current palette LUT, so palette changes
+= never have to touch any surface.
+=
+=================
+*/
+
+void VL_UpdateScreen (SDL_Surface *source)
+{
+    VL_FlushPresent();
+
+    if(screenBits == 8)
+    {
+        SDL_BlitSurface(source, NULL, screen, NULL);
+        SDL_Flip(screen);
+        return;
+    }
+
+    byte *src = VL_LockSurface(source);
+    if(src)
+    {
+        ConvertScreen(src, source->pitch, source->w, source->h, presentlut);
+        VL_UnlockSurface(source);
+    }
+    SDL_Flip(screen);
+}
+
+/*
+=============================================================================
+
+							PRESENT THREAD
+
+ With --asyncpresent, VL_QueueScreen only copies the frame into one of
+ PRESENTBUFFERS buffers and returns, while the present thread converts and
+ flips the frames in order. So the next frame is drawn while the last one
+ waits for the display. At most PRESENTBUFFERS-1 frames are queued; when
+ the queue is full, the oldest queued frame is dropped, so the delay
+ between drawing and showing a frame can't grow.
+
+ Everything else touching the screen calls VL_FlushPresent first.
+
+=============================================================================
+*/
+
+#define PRESENTBUFFERS 3
+
+typedef struct
+{
+    byte     *pixels;               // screenWidth x screenHeight, pitch screenWidth
+    uint32_t  lut[256];             // palette LUT at the time the frame was queued
+} presentframe_t;
+
+static presentframe_t presentframe[PRESENTBUFFERS];
+static int            presentqueue[PRESENTBUFFERS];     // queued frames, oldest first
+static int            presentqueued;
+static int            presentbusy = -1;                 // frame being presented
+
+static SDL_Thread    *presentthread;
+static SDL_mutex     *presentlock;
+static SDL_cond      *presentwork, *presentidle;
+static boolean        presentquit;
+
+uint32_t presentshown;              // frames put on the screen
+uint32_t presentdropped;            // frames replaced by a newer one before being shown
+uint32_t presentlate;               // frames shown while a newer one was already waiting
+
+static int PresentThread (void *data)
+{
+    SDL_mutexP(presentlock);
+    while(1)
+    {
+        while(!presentqueued && !presentquit)
+            SDL_CondWait(presentwork, presentlock);
+        if(presentquit)
+            break;
+
+        presentbusy = presentqueue[0];
+        presentqueued--;
+        memmove(presentqueue, presentqueue + 1, presentqueued * sizeof(int));
+        if(presentqueued)
+            presentlate++;
+        SDL_mutexV(presentlock);
+
+        presentframe_t *frame = &presentframe[presentbusy];
+        ConvertScreen(frame->pixels, screenWidth, screenWidth, screenHeight, frame->lut);
+        SDL_Flip(screen);
+
+        SDL_mutexP(presentlock);
+        presentbusy = -1;
+        presentshown++;
+        SDL_CondSignal(presentidle);
+    }
+    SDL_mutexV(presentlock);
+    return 0;
+}
+
+/*
+=================
+=
+= VL_StartPresentThread
+=
+=================
+*/
+
+void VL_StartPresentThread (void)
+{
+    int i;
+
+    if(presentthread)
+        return;
+
+    for(i = 0; i < PRESENTBUFFERS; i++)
+    {
+        presentframe[i].pixels = (byte *) malloc(screenWidth * screenHeight);
+        CHECKMALLOCRESULT(presentframe[i].pixels);
+    }
+    presentqueued = 0;
+    presentbusy = -1;
+    presentquit = false;
+
+    presentlock = SDL_CreateMutex();
+    presentwork = SDL_CreateCond();
+    presentidle = SDL_CreateCond();
+    if(!presentlock || !presentwork || !presentidle)
+        Quit("Unable to create present thread locks: %s", SDL_GetError());
+
+    presentthread = SDL_CreateThread(PresentThread, NULL);
+    if(!presentthread)
+        Quit("Unable to create present thread: %s", SDL_GetError());
+}
+
+/*
+=================
+=
+= VL_ShutdownPresentThread
+=
+=================
+*/
+
+void VL_ShutdownPresentThread (void)
+{
+    int i;
+
+    if(!presentthread)
+        return;
+
+    VL_FlushPresent();
+
+    SDL_mutexP(presentlock);
+    presentquit = true;
+    SDL_CondSignal(presentwork);
+    SDL_mutexV(presentlock);
+    SDL_WaitThread(presentthread, NULL);
+    presentthread = NULL;
+
+    SDL_DestroyCond(presentidle);
+    SDL_DestroyCond(presentwork);
+    SDL_DestroyMutex(presentlock);
+
+    for(i = 0; i < PRESENTBUFFERS; i++)
+    {
+        free(presentframe[i].pixels);
+        presentframe[i].pixels = NULL;
+    }
+
+    if(presentshown)
+        printf("asyncpresent: %u frames shown, %u dropped, %u late\n",
+            presentshown, presentdropped, presentlate);
+}
+
+/*
+=================
+=
+= VL_FlushPresent
+=
+= Waits until all queued frames are on the screen
+=
+=================
+*/
+
+void VL_FlushPresent (void)
+{
+    if(!presentthread)
+        return;
+
+    SDL_mutexP(presentlock);
+    while(presentqueued || presentbusy >= 0)
+        SDL_CondWait(presentidle, presentlock);
+    SDL_mutexV(presentlock);
+}
+
+/*
+=================
+=
+= VL_QueueScreen
+=
+= Like VL_UpdateScreen, but only queues the frame for the present thread,
+= if it is running
+=
+=================
+*/
+
+void VL_QueueScreen (SDL_Surface *source)
+{
+    int i, j;
+
+    if(!presentthread)
+    {
+        VL_UpdateScreen(source);
+        return;
+    }
+
+    //
+    // find a buffer neither queued nor being presented
+    //
+    SDL_mutexP(presentlock);
+    if(presentqueued == PRESENTBUFFERS - 1)
+    {
+        i = presentqueue[0];
+        presentqueued--;
+        memmove(presentqueue, presentqueue + 1, presentqueued * sizeof(int));
+        presentdropped++;
+    }
+    else
+    {
+        for(i = 0; i < PRESENTBUFFERS; i++)
+        {
+            if(i == presentbusy)
+                continue;
+            for(j = 0; j < presentqueued; j++)
+                if(presentqueue[j] == i)
+                    break;
+            if(j == presentqueued)
+                break;
+        }
+    }
+    SDL_mutexV(presentlock);
+
+    //
+    // copy the frame while the present thread keeps going
+    //
+    presentframe_t *frame = &presentframe[i];
+    unsigned width = source->w < (int) screenWidth ? source->w : screenWidth;
+    unsigned height = source->h < (int) screenHeight ? source->h : screenHeight;
+    byte *src = VL_LockSurface(source);
+    if(src)
+    {
+        for(unsigned y=0; y<height; y++)
+            memcpy(frame->pixels + y * screenWidth, src + y * source->pitch, width);
+        VL_UnlockSurface(source);
+    }
+    memcpy(frame->lut, presentlut, sizeof(frame->lut));
+
+    SDL_mutexP(presentlock);
+    presentqueue[presentqueued++] = i;
+    SDL_CondSignal(presentwork);
+    SDL_mutexV(presentlock);
+}
+
 /*
 =============================================================================
 
@@ -535,6 +1125,144 @@ void VL_BarScaledCoord (int scx, int scy, int scwidth, int scheight, int color)
 ============================================================================
 */
 
+/*
+=================
+=
+= ScaleRow
+=
+= Widens a row of pixels by an integer factor
+=
+=================
+*/
+
+static void ScaleRow (byte *src, byte *dest, unsigned width, unsigned factor)
+{
+    switch(factor)
+    {
+        case 1:
+            memcpy(dest, src, width);
+            return;
+
+        case 2:
+#ifdef SCALEMMX
+            for(; width >= 8; width -= 8, src += 8, dest += 16)
+            {
+                __m64 pix = *(__m64 *) src;
+                *(__m64 *) dest = _mm_unpacklo_pi8(pix, pix);
+                *(__m64 *) (dest + 8) = _mm_unpackhi_pi8(pix, pix);
+            }
+            _mm_empty();
+#endif
+            for(; width; width--, dest += 2)
+                dest[0] = dest[1] = *src++;
+            return;
+
+        case 4:
+#ifdef SCALEMMX
+            for(; width >= 8; width -= 8, src += 8, dest += 32)
+            {
+                __m64 pix = *(__m64 *) src;
+                __m64 lo = _mm_unpacklo_pi8(pix, pix);
+                __m64 hi = _mm_unpackhi_pi8(pix, pix);
+                *(__m64 *) dest = _mm_unpacklo_pi8(lo, lo);
+                *(__m64 *) (dest + 8) = _mm_unpackhi_pi8(lo, lo);
+                *(__m64 *) (dest + 16) = _mm_unpacklo_pi8(hi, hi);
+                *(__m64 *) (dest + 24) = _mm_unpackhi_pi8(hi, hi);
+            }
+            _mm_empty();
+#endif
+            for(; width; width--, dest += 4)
+                dest[0] = dest[1] = dest[2] = dest[3] = *src++;
+            return;
+
+        default:
+            for(; width; width--, dest += factor)
+                memset(dest, *src++, factor);
+            return;
+    }
+}
+
+/*
+=================
+=
+= ScaleBlock
+=
+= Scales a block of width*height source pixels to destwidth*destheight.
+= planesize is 0 for linear sources with pitch bytes per row. Otherwise
+= the source is a munged VGA pic with four planes of planesize bytes and
+= pitch bytes per plane row, which is deplanarized once per row.
+= Whole destination rows are repeated with memcpy. Sizes which are not
+= multiples of the source size are scaled with fixed point steps.
+=
+=================
+*/
+
+static void ScaleBlock (byte *src, unsigned pitch, unsigned planesize, int srcx,
+    int width, int height, byte *dest, unsigned destpitch,
+    unsigned destwidth, unsigned destheight)
+{
+    byte    *row;
+    int      srcy, lastsrcy = -1;
+    unsigned factor;
+    boolean  integral;
+    fixed    xstep;
+
+    if(!width || !height)
+        return;
+    factor = destwidth / width;
+    integral = destwidth == factor * width;
+    xstep = (width << 16) / destwidth;
+
+    for(unsigned y = 0; y < destheight; y++, dest += destpitch)
+    {
+        srcy = y * height / destheight;
+        if(srcy == lastsrcy)
+        {
+            memcpy(dest, dest - destpitch, destwidth);
+            continue;
+        }
+        lastsrcy = srcy;
+
+        if(planesize)
+        {
+            byte *plane = src + srcy * pitch;
+            for(int x = 0; x < width; x++)
+            {
+                int i = srcx + x;
+                scalerow[x] = plane[(i >> 2) + (i & 3) * planesize];
+            }
+            row = scalerow;
+        }
+        else
+            row = src + srcy * pitch + srcx;
+
+        if(integral)
+            ScaleRow(row, dest, width, factor);
+        else
+        {
+            fixed frac = 0;
+            for(unsigned x = 0; x < destwidth; x++, frac += xstep)
+                dest[x] = row[frac >> 16];
+        }
+    }
+}
+
+/*
+=================
+=
+= VL_ScaleBuffer
+=
+= Scales a row-major 8-bit buffer to destwidth x destheight at dest
+=
+=================
+*/
+
+void VL_ScaleBuffer (byte *src, unsigned pitch, int width, int height,
+    byte *dest, unsigned destpitch, unsigned destwidth, unsigned destheight)
+{
+    ScaleBlock(src, pitch, 0, 0, width, height, dest, destpitch, destwidth, destheight);
+}
+
 /*
 =================
 =
@@ -553,14 +1281,8 @@ void VL_MemToLatch(byte *source, int width, int height,
     VL_LockSurface(destSurface);
     int pitch = destSurface->pitch;
     byte *dest = (byte *) destSurface->pixels + y * pitch + x;
-    for(int ysrc = 0; ysrc < height; ysrc++)
-    {
-        for(int xsrc = 0; xsrc < width; xsrc++)
-        {
-            dest[ysrc * pitch + xsrc] = source[(ysrc * (width >> 2) + (xsrc >> 2))
-                + (xsrc & 3) * (width >> 2) * height];
-        }
-    }
+    ScaleBlock(source, width >> 2, (width >> 2) * height, 0, width, height,
+        dest, pitch, width, height);
     VL_UnlockSurface(destSurface);
 }
 
@@ -584,21 +1306,9 @@ void VL_MemToScreenScaledCoord (byte *source, int width, int height, int destx,
             && "VL_MemToScreenScaledCoord: Destination rectangle out of bounds!");
 
     VL_LockSurface(curSurface);
-    byte *vbuf = (byte *) curSurface->pixels;
-    for(int j=0,scj=0; j<height; j++, scj+=scaleFactor)
-    {
-        for(int i=0,sci=0; i<width; i++, sci+=scaleFactor)
-        {
-            byte col = source[(j*(width>>2)+(i>>2))+(i&3)*(width>>2)*height];
-            for(unsigned m=0; m<scaleFactor; m++)
-            {
-                for(unsigned n=0; n<scaleFactor; n++)
-                {
-                    vbuf[(scj+m+desty)*curPitch+sci+n+destx] = col;
-                }
-            }
-        }
-    }
+    byte *vbuf = (byte *) curSurface->pixels + desty * curPitch + destx;
+    ScaleBlock(source, width >> 2, (width >> 2) * height, 0, width, height,
+        vbuf, curPitch, width * scaleFactor, height * scaleFactor);
     VL_UnlockSurface(curSurface);
 }
 
@@ -623,21 +1333,9 @@ void VL_MemToScreenScaledCoord (byte *source, int origwidth, int origheight, int
             && "VL_MemToScreenScaledCoord: Destination rectangle out of bounds!");
 
     VL_LockSurface(curSurface);
-    byte *vbuf = (byte *) curSurface->pixels;
-    for(int j=0,scj=0; j<height; j++, scj+=scaleFactor)
-    {
-        for(int i=0,sci=0; i<width; i++, sci+=scaleFactor)
-        {
-            byte col = source[((j+srcy)*(origwidth>>2)+((i+srcx)>>2))+((i+srcx)&3)*(origwidth>>2)*origheight];
-            for(unsigned m=0; m<scaleFactor; m++)
-            {
-                for(unsigned n=0; n<scaleFactor; n++)
-                {
-                    vbuf[(scj+m+desty)*curPitch+sci+n+destx] = col;
-                }
-            }
-        }
-    }
+    byte *vbuf = (byte *) curSurface->pixels + desty * curPitch + destx;
+    ScaleBlock(source + srcy * (origwidth >> 2), origwidth >> 2, (origwidth >> 2) * origheight,
+        srcx, width, height, vbuf, curPitch, width * scaleFactor, height * scaleFactor);
     VL_UnlockSurface(curSurface);
 }
 
@@ -648,6 +1346,9 @@ void VL_MemToScreenScaledCoord (byte *source, int origwidth, int origheight, int
 =
 = VL_LatchToScreen
 =
+= The latches have the same palette as the screen buffer, so the pixels
+= are just copied (or scaled) without any color mapping
+=
 =================
 */
 
@@ -658,67 +1359,16 @@ void VL_LatchToScreenScaledCoord(SDL_Surface *source, int xsrc, int ysrc,
 			&& scydest >= 0 && scydest + height * scaleFactor <= screenHeight
 			&& "VL_LatchToScreenScaledCoord: Destination rectangle out of bounds!");
 
-	if(scaleFactor == 1)
-    {
-        // HACK: If screenBits is not 8 and the screen is faded out, the
-        //       result will be black when using SDL_BlitSurface. The reason
-        //       is that the logical palette needed for the transformation
-        //       to the screen color depth is not equal to the logical
-        //       palette of the latch (the latch is not faded). Therefore,
-        //       SDL tries to map the colors...
-        //       The result: All colors are mapped to black.
-        //       So, we do the blit on our own...
-        if(screenBits != 8)
-        {
-            VL_LockSurface(source);
-            byte *src = (byte *) source->pixels;
-            unsigned srcPitch = source->pitch;
-
-            VL_LockSurface(curSurface);
-            byte *vbuf = (byte *) curSurface->pixels;
-            for(int j=0,scj=0; j<height; j++, scj++)
-            {
-                for(int i=0,sci=0; i<width; i++, sci++)
-                {
-                    byte col = src[(ysrc + j)*srcPitch + xsrc + i];
-                    vbuf[(scydest+scj)*curPitch+scxdest+sci] = col;
-                }
-            }
-            VL_UnlockSurface(curSurface);
-            VL_UnlockSurface(source);
-        }
-        else
-        {
-            SDL_Rect srcrect = { xsrc, ysrc, width, height };
-            SDL_Rect destrect = { scxdest, scydest, 0, 0 }; // width and height are ignored
-            SDL_BlitSurface(source, &srcrect, curSurface, &destrect);
-        }
-    }
-    else
-    {
-        VL_LockSurface(source);
-        byte *src = (byte *) source->pixels;
-        unsigned srcPitch = source->pitch;
+    VL_LockSurface(source);
+    byte *src = (byte *) source->pixels;
+    unsigned srcPitch = source->pitch;
 
-        VL_LockSurface(curSurface);
-        byte *vbuf = (byte *) curSurface->pixels;
-        for(int j=0,scj=0; j<height; j++, scj+=scaleFactor)
-        {
-            for(int i=0,sci=0; i<width; i++, sci+=scaleFactor)
-            {
-                byte col = src[(ysrc + j)*srcPitch + xsrc + i];
-                for(unsigned m=0; m<scaleFactor; m++)
-                {
-                    for(unsigned n=0; n<scaleFactor; n++)
-                    {
-                        vbuf[(scydest+scj+m)*curPitch+scxdest+sci+n] = col;
-                    }
-                }
-            }
-        }
-        VL_UnlockSurface(curSurface);
-        VL_UnlockSurface(source);
-    }
+    VL_LockSurface(curSurface);
+    byte *vbuf = (byte *) curSurface->pixels + scydest * curPitch + scxdest;
+    ScaleBlock(src + ysrc * srcPitch, srcPitch, 0, xsrc, width, height,
+        vbuf, curPitch, width * scaleFactor, height * scaleFactor);
+    VL_UnlockSurface(curSurface);
+    VL_UnlockSurface(source);
 }
 
 //===========================================================================
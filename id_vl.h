@@ -21,6 +21,9 @@ extern	boolean  screenfaded;
 extern	unsigned bordercolor;
 
 extern SDL_Color gamepal[256];
+extern SDL_Color curpal[256];
+extern uint32_t *presentlut;
+extern uint32_t presentshown, presentdropped, presentlate;
 
 //===========================================================================
 
@@ -39,10 +42,20 @@ void VL_FillPalette (int red, int green, int blue);
 void VL_SetColor    (int color, int red, int green, int blue);
 void VL_GetColor    (int color, int *red, int *green, int *blue);
 void VL_SetPalette  (SDL_Color *palette, bool forceupdate);
+void VL_SetPaletteLUT   (SDL_Color *palette, uint32_t *lut, bool forceupdate);
+void VL_BuildPaletteLUT (SDL_Color *palette, uint32_t *lut);
 void VL_GetPalette  (SDL_Color *palette);
+void VL_SetFindColorPalette (SDL_Color *palette);
+byte VL_FindColor   (byte red, byte green, byte blue);
 void VL_FadeOut     (int start, int end, int red, int green, int blue, int steps);
 void VL_FadeIn      (int start, int end, SDL_Color *palette, int steps);
 
+void VL_UpdateScreen (SDL_Surface *source);
+void VL_QueueScreen  (SDL_Surface *source);
+void VL_FlushPresent (void);
+void VL_StartPresentThread (void);
+void VL_ShutdownPresentThread (void);
+
 byte *VL_LockSurface(SDL_Surface *surface);
 void VL_UnlockSurface(SDL_Surface *surface);
 
@@ -66,6 +79,8 @@ void inline VL_ClearScreen(int color)
 
 void VL_MungePic                (byte *source, unsigned width, unsigned height);
 void VL_DrawPicBare             (int x, int y, byte *pic, int width, int height);
+void VL_ScaleBuffer             (byte *src, unsigned pitch, int width, int height,
+                                    byte *dest, unsigned destpitch, unsigned destwidth, unsigned destheight);
 void VL_MemToLatch              (byte *source, int width, int height,
                                     SDL_Surface *destSurface, int x, int y);
 void VL_ScreenToScreen          (SDL_Surface *source, SDL_Surface *dest);
@@ -40,6 +40,11 @@
 //#define USE_RAIN            // Enables rain support (see wl_atmos.cpp)
 //#define USE_SNOW            // Enables snow support (see wl_atmos.cpp)
 //#define FIXRAINSNOWLEAKS    // Enables leaking ceilings fix (by Adam Biser, only needed if maps with rain/snow and ceilings exist)
+//#define USE_MTRENDER        // Enables the multithreaded stripe renderer (see wl_draw.cpp, --renderthreads)
+#define USE_COLUMNVIEW        // Draws the 3D view into a column-major buffer, which is transposed on present (see wl_draw.cpp)
+//#define USE_SPRITECOVERAGE  // Draws sprites from front to back and skips pixels already covered by nearer sprites (see wl_draw.cpp)
+#define USE_PVS               // Skips objects which can't be seen from the player's tile using per map visibility sets (see wl_pvs.cpp)
+//#define CA_BENCHMARKS       // Adds --huffbench and --mapbench to check the decompression against the original code (see id_ca.cpp)
 
 #define DEBUGKEYS             // Comment this out to compile without the Tab debug keys
 #define ARTSEXTERN
@@ -57,8 +57,13 @@ void DrawStarSky(byte *vbuf, uint32_t vbufPitch)
 
     byte *ptr = vbuf;
     int i;
+#ifdef USE_COLUMNVIEW
+    for(i = 0; i < viewwidth; i++, ptr += vbufPitch)
+        memset(ptr, 0, hvheight);
+#else
     for(i = 0; i < hvheight; i++, ptr += vbufPitch)
         memset(ptr, 0, viewwidth);
+#endif
 
     for(i = 0; i < MAXPOINTS; i++)
     {
@@ -72,7 +77,7 @@ void DrawStarSky(byte *vbuf, uint32_t vbufPitch)
         int32_t xx = x / z + hvwidth;
         int32_t yy = hvheight - y / z;
         if(xx >= 0 && xx < viewwidth && yy >= 0 && yy < hvheight)
-            vbuf[yy * vbufPitch + xx] = shade + 15;
+            vbuf[VIEWOFS(xx, yy, vbufPitch)] = shade + 15;
     }
 
     int32_t x = 16384 * viewcos + 16384 * viewsin;
@@ -90,7 +95,7 @@ void DrawStarSky(byte *vbuf, uint32_t vbufPitch)
         if(yy > viewheight - 11) stopy = viewheight - yy;
         for(; i < stopx; i++)
             for(int j = starty; j < stopy; j++)
-                vbuf[(yy + j) * vbufPitch + xx + i] = moon[j * 10 + i];
+                vbuf[VIEWOFS(xx + i, yy + j, vbufPitch)] = moon[j * 10 + i];
     }
 }
 
@@ -150,10 +155,10 @@ void DrawRain(byte *vbuf, uint32_t vbufPitch)
             if(MAPSPOT(floorx, floory, 2) >> 8) continue;
 #endif
 
-            vbuf[yy * vbufPitch + xx] = shade+15;
-            vbuf[(yy - 1) * vbufPitch + xx] = shade+16;
+            vbuf[VIEWOFS(xx, yy, vbufPitch)] = shade+15;
+            vbuf[VIEWOFS(xx, yy - 1, vbufPitch)] = shade+16;
             if(yy > 2)
-                vbuf[(yy - 2) * vbufPitch + xx] = shade+17;
+                vbuf[VIEWOFS(xx, yy - 2, vbufPitch)] = shade+17;
         }
     }
 }
@@ -215,13 +220,13 @@ void DrawSnow(byte *vbuf, uint32_t vbufPitch)
 
             if(shade < 10)
             {
-                vbuf[yy * vbufPitch + xx] = shade+17;
-                vbuf[yy * vbufPitch + xx - 1] = shade+16;
-                vbuf[(yy - 1) * vbufPitch + xx] = shade+16;
-                vbuf[(yy - 1) * vbufPitch + xx - 1] = shade+15;
+                vbuf[VIEWOFS(xx, yy, vbufPitch)] = shade+17;
+                vbuf[VIEWOFS(xx - 1, yy, vbufPitch)] = shade+16;
+                vbuf[VIEWOFS(xx, yy - 1, vbufPitch)] = shade+16;
+                vbuf[VIEWOFS(xx - 1, yy - 1, vbufPitch)] = shade+15;
             }
             else
-                vbuf[yy * vbufPitch + xx] = shade+15;
+                vbuf[VIEWOFS(xx, yy, vbufPitch)] = shade+15;
         }
     }
 }
@@ -208,16 +208,19 @@ void InitSky()
 }
 
 // Based on Textured Floor and Ceiling by DarkOne
-void DrawClouds(byte *vbuf, unsigned vbufPitch, int min_wallheight)
+// Called once per frame before the clouds are drawn
+void MoveClouds()
 {
-    // Move clouds
     fixed moveDist = tics * curSky->speed;
     cloudx += FixedMul(moveDist,sintable[curSky->angle]);
     cloudy -= FixedMul(moveDist,costable[curSky->angle]);
+}
 
-    // Draw them
+// Only draws the columns of the current render stripe
+void DrawClouds(byte *vbuf, unsigned vbufPitch, int min_wallheight)
+{
     int y0, halfheight;
-    unsigned top_offset0;
+    unsigned top_offset0, xstep, ystep;
     fixed dist;                                // distance to row projection
     fixed tex_step;                            // global step per one screen pixel
     fixed gu, gv, du, dv;                      // global texture coordinates
@@ -229,10 +232,12 @@ void DrawClouds(byte *vbuf, unsigned vbufPitch, int min_wallheight)
     if(y0 > halfheight)
         return;                                // view obscured by walls
     if(!y0) y0 = 1;                            // don't let division by zero
-    top_offset0 = vbufPitch * (halfheight - y0 - 1);
+    top_offset0 = VIEWOFS(0, halfheight - y0 - 1, vbufPitch);
+    xstep = VIEWXSTEP(vbufPitch);
+    ystep = VIEWYSTEP(vbufPitch);
 
     // draw horizontal lines
-    for(int y = y0, top_offset = top_offset0; y < halfheight; y++, top_offset -= vbufPitch)
+    for(int y = y0, top_offset = top_offset0; y < halfheight; y++, top_offset -= ystep)
     {
         dist = (heightnumerator / y) << 8;
         gu =  viewx + FixedMul(dist, viewcos) + cloudx;
@@ -240,9 +245,9 @@ void DrawClouds(byte *vbuf, unsigned vbufPitch, int min_wallheight)
         tex_step = (dist << 8) / viewwidth / 175;
         du =  FixedMul(tex_step, viewsin);
         dv = -FixedMul(tex_step, viewcos);
-        gu -= (viewwidth >> 1)*du;
-        gv -= (viewwidth >> 1)*dv;          // starting point (leftmost)
-        for(int x = 0, top_add = top_offset; x < viewwidth; x++, top_add++)
+        gu -= ((viewwidth >> 1) - stripestart)*du;
+        gv -= ((viewwidth >> 1) - stripestart)*dv; // starting point (leftmost)
+        for(int x = stripestart, top_add = top_offset + stripestart * xstep; x < stripeend; x++, top_add += xstep)
         {
             if(wallheight[x] >> 3 <= y)
             {
@@ -904,6 +904,9 @@ extern  fixed    focallength;
 extern  int      viewscreenx, viewscreeny;
 extern  int      viewwidth;
 extern  int      viewheight;
+extern  int      renderwidth, renderheight;
+extern  int      detailshift;
+extern  boolean  lowdetail;
 extern  short    centerx;
 extern  int32_t  heightnumerator;
 extern  fixed    scale;
@@ -933,11 +936,29 @@ extern  int      param_audiobuffer;
 extern  int      param_mission;
 extern  boolean  param_goodtimes;
 extern  boolean  param_ignorenumchunks;
+extern  boolean  param_mappages;
+extern  int      param_pagebudget;
+extern  boolean  param_prefetch;
+extern  boolean  param_wallspans;
+extern  boolean  param_fusedclear;
+extern  boolean  param_interpolate;
+extern  boolean  param_asyncpresent;
+extern  int      param_framebudget;
+extern  boolean  param_lowdetail;
+extern  boolean  param_mipmaps;
+#ifdef USE_SHADING
+extern  int      param_shadecache;
+#endif
+#ifdef USE_MTRENDER
+extern  int      param_renderthreads;
+#endif
+extern  int      param_timedemo;
 
 
 void            NewGame (int difficulty,int episode);
 void            CalcProjection (int32_t focal);
 void            NewViewSize (int width);
+void            SetRenderSize (unsigned width, unsigned height, int shift);
 boolean         SetViewSize (unsigned width, unsigned height);
 boolean         LoadTheGame(FILE *file,int x,int y);
 boolean         SaveTheGame(FILE *file,int x,int y);
@@ -969,6 +990,12 @@ void    ShowActStatus();
 void    PlayDemo (int demonumber);
 void    RecordDemo (void);
 
+extern  boolean         timedemo;
+
+void    TimeDemo (int demonumber);
+uint32_t TimeDemoClock (void);
+void    TimeDemoFrame (uint32_t frametime);
+
 
 #ifdef SPEAR
 extern  int32_t            spearx,speary;
@@ -1105,6 +1132,116 @@ int DebugKeys (void);
 =============================================================================
 */
 
+//
+// Variables marked RENDERLOCAL hold the ray and post state of the columns
+// currently being drawn. With USE_MTRENDER every render thread gets its own
+// copy, so the view can be drawn in vertical stripes in parallel.
+//
+#ifdef USE_MTRENDER
+    #ifdef _MSC_VER
+        #define RENDERLOCAL __declspec(thread)
+    #else
+        #define RENDERLOCAL __thread
+    #endif
+    #define MAXRENDERTHREADS 8
+
+    extern  int     renderthreads;
+
+    void    StartRenderThreads (void);
+    void    ShutdownRenderThreads (void);
+#else
+    #define RENDERLOCAL
+#endif
+
+extern  RENDERLOCAL int stripestart, stripeend;     // columns of the current stripe
+
+//
+// All 3D view drawing addresses pixels with these macros. With USE_COLUMNVIEW
+// the view is drawn column by column into columnbuffer, where pitch is the
+// distance between two columns, and transposed to screenBuffer afterwards.
+//
+#ifdef USE_COLUMNVIEW
+    #define VIEWOFS(x, y, pitch)    ((x) * (pitch) + (y))
+    #define VIEWXSTEP(pitch)        (pitch)
+    #define VIEWYSTEP(pitch)        1
+
+    extern  byte    *columnbuffer;
+#else
+    #define VIEWOFS(x, y, pitch)    ((y) * (pitch) + (x))
+    #define VIEWXSTEP(pitch)        1
+    #define VIEWYSTEP(pitch)        (pitch)
+#endif
+
+//
+// With USE_SPRITECOVERAGE the sprites are drawn from front to back and every
+// drawn sprite pixel is marked in spritecoverage (coveragewords uint32_t per
+// column), so farther sprites skip it. Runs of rows are handled a word of 32
+// rows at a time, rows of fully covered words aren't visited at all.
+//
+#ifdef USE_SPRITECOVERAGE
+    extern  uint32_t *spritecoverage;
+    extern  int     coveragewords;
+
+    // bits of the rows y to endy - 1 in the word of row y, endy may be
+    // at most the first row of the next word
+    static inline uint32_t CoverMask(int y, int endy)
+    {
+        int n = endy - y;
+        return (n == 32 ? 0xffffffff : (1u << n) - 1) << (y & 31);
+    }
+
+    // returns true, if all rows y to endy - 1 of the column are covered
+    static inline bool RowsCovered(uint32_t *cov, int y, int endy)
+    {
+        int next;
+        uint32_t mask;
+
+        for(; y < endy; y = next)
+        {
+            next = (y | 31) + 1;
+            if(next > endy) next = endy;
+            mask = CoverMask(y, next);
+            if((cov[y >> 5] & mask) != mask)
+                return false;
+        }
+        return true;
+    }
+
+    // draws col into the rows y to endy - 1 of the column at vmem, which
+    // aren't covered yet, covers them and returns vmem at row endy
+    static inline byte *CoverRows(byte *vmem, unsigned pitch, uint32_t *cov,
+        int y, int endy, byte col)
+    {
+        int next;
+        uint32_t mask, bits;
+
+        for(; y < endy; y = next)
+        {
+            next = (y | 31) + 1;
+            if(next > endy) next = endy;
+            mask = CoverMask(y, next);
+            bits = cov[y >> 5] & mask;
+            cov[y >> 5] |= mask;
+            if(bits == mask)
+                vmem += (next - y) * VIEWYSTEP(pitch);      // covered already
+            else if(!bits)
+            {
+                for(; y < next; y++, vmem += VIEWYSTEP(pitch))
+                    *vmem = col;
+            }
+            else
+            {
+                for(bits >>= y & 31; y < next; y++, bits >>= 1, vmem += VIEWYSTEP(pitch))
+                {
+                    if(!(bits & 1))
+                        *vmem = col;
+                }
+            }
+        }
+        return vmem;
+    }
+#endif
+
 //
 // math tables
 //
@@ -1123,9 +1260,11 @@ extern  boolean fizzlein, fpscounter;
 
 extern  fixed   viewx,viewy;                    // the focal point
 extern  fixed   viewsin,viewcos;
+extern  int     viewfineangle;
 
 void    ThreeDRefresh (void);
 void    CalcTics (void);
+void    BuildScalers (void);
 
 typedef struct
 {
@@ -11,12 +11,12 @@
 void Scale3DShaper(int x1, int x2, int shapenum, uint32_t flags, fixed ny1, fixed ny2,
                    fixed nx1, fixed nx2, byte *vbuf, unsigned vbufPitch)
 {
-    t_compshape *shape;
-    unsigned scale1,starty,endy;
-    word *cmdptr;
-    byte *line;
+    spriteshape_t *shape;
+    spritespan_t *span;
+    byte *texels;
+    unsigned scale1,endy;
     byte *vmem;
-    int dx,len,i,newstart,ycnt,pixheight,screndy,upperedge,scrstarty;
+    int dx,len,i,ycnt,pixheight,screndy,upperedge,scrstarty;
     unsigned j;
     fixed height,dheight,height1,height2;
     int xpos[TEXTURESIZE+1];
@@ -24,8 +24,13 @@ void Scale3DShaper(int x1, int x2, int shapenum, uint32_t flags, fixed ny1, fixe
     fixed dxx=(ny2-ny1)<<8,dzz=(nx2-nx1)<<8;
     fixed dxa=0,dza=0;
     byte col;
+#ifdef USE_SPRITECOVERAGE
+    uint32_t *cov;
+    int covtop,covbottom;
+#endif
 
-    shape = (t_compshape *) PM_GetSprite(shapenum);
+    shape = PM_GetSpriteShape(shapenum);
+    texels = (byte *) PM_GetSprite(shapenum);
 
     len=shape->rightpix-shape->leftpix+1;
     if(!len) return;
@@ -54,17 +59,15 @@ void Scale3DShaper(int x1, int x2, int shapenum, uint32_t flags, fixed ny1, fixe
     height2 = heightnumerator/((nx1+(dza>>8))>>8);
     dheight=(((fixed)height2-(fixed)height1)<<12)/(fixed)dx;
 
-    cmdptr = (word *) shape->dataofs;
-
     i=0;
-    if(x2>viewwidth) x2=viewwidth;
+    if(x2>stripeend) x2=stripeend;
 
     for(i=0;i<len;i++)
     {
         for(slinex=xpos[i];slinex<xpos[i+1] && slinex<x2;slinex++)
         {
             height+=dheight;
-            if(slinex<0) continue;
+            if(slinex<stripestart) continue;
 
             scale1=(unsigned)(height>>15);
 
@@ -81,18 +84,24 @@ void Scale3DShaper(int x1, int x2, int shapenum, uint32_t flags, fixed ny1, fixe
                 pixheight=scale1*SPRITESCALEFACTOR;
                 upperedge=viewheight/2-scale1;
 
-                line=(byte *)shape + cmdptr[i];
+#ifdef USE_SPRITECOVERAGE
+                cov=spritecoverage+slinex*coveragewords;
+                covtop=(int)((shape->top*pixheight)>>6)+upperedge;
+                covbottom=(int)((shape->bottom*pixheight)>>6)+upperedge;
+                if(covtop<0) covtop=0;
+                if(covbottom>viewheight) covbottom=viewheight;
+                if(RowsCovered(cov,covtop,covbottom))
+                    continue;               // nearer sprites cover all rows of the shape
+#endif
 
-                while((endy = READWORD(line)) != 0)
+                for(span=shape->columns[i];span<shape->columns[i+1];span++)
                 {
-                    endy >>= 1;
-                    newstart = READWORD(line);
-                    starty = READWORD(line) >> 1;
-                    j=starty;
+                    endy = span->end;
+                    j=span->start;
                     ycnt=j*pixheight;
                     screndy=(ycnt>>6)+upperedge;
-                    if(screndy<0) vmem=vbuf+slinex;
-                    else vmem=vbuf+screndy*vbufPitch+slinex;
+                    if(screndy<0) vmem=vbuf+VIEWOFS(slinex,0,vbufPitch);
+                    else vmem=vbuf+VIEWOFS(slinex,screndy,vbufPitch);
                     for(;j<endy;j++)
                     {
                         scrstarty=screndy;
@@ -101,19 +110,23 @@ void Scale3DShaper(int x1, int x2, int shapenum, uint32_t flags, fixed ny1, fixe
                         if(scrstarty!=screndy && screndy>0)
                         {
 #ifdef USE_SHADING
-                            col=curshades[((byte *)shape)[newstart+j]];
+                            col=curshades[texels[span->texofs+j]];
 #else
-                            col=((byte *)shape)[newstart+j];
+                            col=texels[span->texofs+j];
 #endif
                             if(scrstarty<0) scrstarty=0;
                             if(screndy>viewheight) screndy=viewheight,j=endy;
 
+#ifdef USE_SPRITECOVERAGE
+                            vmem=CoverRows(vmem,vbufPitch,cov,scrstarty,screndy,col);
+#else
                             while(scrstarty<screndy)
                             {
                                 *vmem=col;
-                                vmem+=vbufPitch;
+                                vmem+=VIEWYSTEP(vbufPitch);
                                 scrstarty++;
                             }
+#endif
                         }
                     }
                 }
@@ -6,6 +6,17 @@
 #include "wl_cloudsky.h"
 #include "wl_atmos.h"
 #include "wl_shade.h"
+#include "wl_pvs.h"
+#include "wl_mipmap.h"
+
+#ifdef USE_MTRENDER
+#include <SDL_thread.h>
+#endif
+
+#if defined(USE_COLUMNVIEW) && (defined(_M_IX86) || defined(__MMX__))
+#include <mmintrin.h>
+#define TRANSPOSEMMX
+#endif
 
 /*
 =============================================================================
@@ -20,6 +31,14 @@
 
 #define ACTORSIZE       0x4000
 
+// what the last ray hit, plain walls can be continued as wall spans
+#define HITFACE_NONE    0
+#define HITFACE_VERT    1
+#define HITFACE_HORIZ   2
+
+#define WALLSPANSTEP    16              // maximum number of columns of one wall span
+#define WALLSPANMARGIN  0x400           // distance kept to tile corners and borders
+
 /*
 =============================================================================
 
@@ -38,7 +57,18 @@ boolean fpscounter;
 int fps_frames=0, fps_time=0, fps=0;
 
 int *wallheight;
-int min_wallheight;
+RENDERLOCAL int min_wallheight;
+
+#ifdef USE_COLUMNVIEW
+byte *columnbuffer;
+#endif
+
+#ifdef USE_SPRITECOVERAGE
+uint32_t *spritecoverage;
+int coveragewords;
+#endif
+
+RENDERLOCAL int stripestart, stripeend;
 
 //
 // math tables
@@ -54,6 +84,7 @@ fixed *costable = sintable+(ANGLES/4);
 fixed   viewx,viewy;                    // the focal point
 short   viewangle;
 fixed   viewsin,viewcos;
+int     viewfineangle = -1;             // fine view angle between two tics, -1 uses player->angle
 
 void    TransformActor (objtype *ob);
 void    BuildTables (void);
@@ -68,10 +99,10 @@ void    ThreeDRefresh (void);
 //
 // wall optimization variables
 //
-int     lastside;               // true for vertical
-int32_t    lastintercept;
-int     lasttilehit;
-int     lasttexture;
+RENDERLOCAL int     lastside;               // true for vertical
+RENDERLOCAL int32_t lastintercept;
+RENDERLOCAL int     lasttilehit;
+RENDERLOCAL int     lasttexture;
 
 //
 // ray tracing variables
@@ -81,15 +112,17 @@ longword xpartialup,xpartialdown,ypartialup,ypartialdown;
 
 short   midangle,angle;
 
-word    tilehit;
-int     pixx;
+RENDERLOCAL word    tilehit;
+RENDERLOCAL int     pixx;
 
-short   xtile,ytile;
-short   xtilestep,ytilestep;
-int32_t    xintercept,yintercept;
-word    xstep,ystep;
-word    xspot,yspot;
-int     texdelta;
+RENDERLOCAL short   xtile,ytile;
+RENDERLOCAL short   xtilestep,ytilestep;
+RENDERLOCAL int32_t xintercept,yintercept;
+RENDERLOCAL int32_t xstep,ystep;
+RENDERLOCAL longword xpartial,ypartial;
+RENDERLOCAL word    xspot,yspot;
+RENDERLOCAL int     texdelta;
+RENDERLOCAL int     hitface;                // HITFACE_* of the last ray
 
 word horizwall[MAXWALLTILES],vertwall[MAXWALLTILES];
 
@@ -271,11 +304,194 @@ int CalcHeight()
 ===================
 */
 
-byte *postsource;
-int postx;
-int postwidth;
+RENDERLOCAL byte *postsource;
+RENDERLOCAL int postx;
+RENDERLOCAL int postwidth;
+RENDERLOCAL int postpage;               // wall texture postsource points into
+RENDERLOCAL int posttexture;            // offset of postsource in postpage
 
-void ScalePost()
+static inline void SetPostSource (int page, int texture)
+{
+    postsource = PM_GetTexture(page) + texture;
+    postpage = page;
+    posttexture = texture;
+}
+
+//
+// Returns the mip level whose texels are closest to one pixel for a post of
+// the given height (wallheight >> 3, half the height on screen)
+//
+static inline int PostMipLevel (int height)
+{
+    int level = 0;
+
+    while(level < MIPLEVELS && (height << (level + 2)) <= TEXTURESIZE)
+        level++;
+    return level;
+}
+
+//
+// A scaler holds the texel row for every view row covered by a post of the
+// given height (wallheight >> 3). The scalers are built for the current
+// viewheight by BuildScalers, taller posts use ScaleLargePost.
+//
+#define MAXSCALERMEMORY (2L*1024*1024)  // budget for the texel tables
+
+typedef struct
+{
+    int  top;                           // first view row drawn
+    int  count;                         // number of rows drawn
+    byte *texel;                        // texel row for every drawn view row
+} scaler_t;
+
+static scaler_t *scalers;
+static int      numscalers;
+static byte     *scalerdata;
+
+//
+// When nothing else is drawn behind the walls, every post fills the rows
+// above and below it from clearcolumn instead of clearing the view first
+//
+static byte     *clearcolumn;           // ceiling and floor color of every view row
+static boolean  fusedclear;             // posts fill their column this frame
+
+/*
+===================
+=
+= BuildScalers
+=
+= Builds the scalers with the same stepping as ScaleLargePost, so both
+= draw a post exactly the same way. Must be called when viewheight changes.
+=
+===================
+*/
+
+void BuildScalers (void)
+{
+    int32_t size;
+    int ywcount, yw, yd, top, yend, y, height;
+    byte *texel;
+
+    free(scalers);
+    free(scalerdata);
+    free(clearcolumn);
+
+    clearcolumn = (byte *) malloc(viewheight ? viewheight : 1);
+    CHECKMALLOCRESULT(clearcolumn);
+
+    //
+    // cover posts up to four times the view height as long as the budget lasts
+    //
+    size = 0;
+    for(numscalers = 0; numscalers <= viewheight * 2; numscalers++)
+    {
+        height = numscalers * 2 < viewheight ? numscalers * 2 : viewheight;
+        if(size + height > MAXSCALERMEMORY)
+            break;
+        size += height;
+    }
+
+    scalers = (scaler_t *) malloc(numscalers * sizeof(scaler_t));
+    CHECKMALLOCRESULT(scalers);
+    scalerdata = (byte *) malloc(size ? size : 1);
+    CHECKMALLOCRESULT(scalerdata);
+
+    texel = scalerdata;
+    for(height = 0; height < numscalers; height++)
+    {
+        ywcount = yd = height;
+        if(yd <= 0) yd = 100;
+
+        top = viewheight / 2 - ywcount;
+        if(top < 0) top = 0;
+
+        yend = viewheight / 2 + ywcount - 1;
+        yw = TEXTURESIZE - 1;
+
+        while(yend >= viewheight)
+        {
+            ywcount -= TEXTURESIZE/2;
+            while(ywcount <= 0)
+            {
+                ywcount += yd;
+                yw--;
+            }
+            yend--;
+        }
+
+        //
+        // the texels are stored from yend upwards and moved down afterwards,
+        // if the texture ran out before reaching top
+        //
+        y = yend;
+        if(yw >= 0)
+        {
+            while(y >= top)
+            {
+                texel[y - top] = (byte) yw;
+                y--;
+                ywcount -= TEXTURESIZE/2;
+                if(ywcount <= 0)
+                {
+                    do
+                    {
+                        ywcount += yd;
+                        yw--;
+                    }
+                    while(ywcount <= 0);
+                    if(yw < 0) break;
+                }
+            }
+        }
+        if(y + 1 > top)
+            memmove(texel, texel + (y + 1 - top), yend - y);
+
+        scalers[height].top = y + 1;    // rows y+1 to yend are drawn
+        scalers[height].count = yend - y;
+        scalers[height].texel = texel;
+        texel += scalers[height].count;
+    }
+}
+
+/*
+===================
+=
+= FillPostColumn
+=
+= Fills the rows of the current post column above top and from end down
+= with the ceiling and floor colors
+=
+===================
+*/
+
+static void FillPostColumn (int top, int end)
+{
+    byte *dest = vbuf + VIEWOFS(postx, 0, vbufPitch);
+#ifdef USE_COLUMNVIEW
+    memcpy(dest, clearcolumn, top);
+    memcpy(dest + end, clearcolumn + end, viewheight - end);
+#else
+    int y;
+
+    for(y = 0; y < top; y++, dest += vbufPitch)
+        *dest = clearcolumn[y];
+    for(y = end, dest += (end - top) * vbufPitch; y < viewheight; y++, dest += vbufPitch)
+        *dest = clearcolumn[y];
+#endif
+}
+
+/*
+===================
+=
+= ScaleLargePost
+=
+= Steps through the texture with an error accumulator, used for posts
+= too tall for a scaler
+=
+===================
+*/
+
+static void ScaleLargePost (void)
 {
     int ywcount, yoffs, yw, yd, yendoffs;
     byte col;
@@ -284,12 +500,15 @@ void ScalePost()
     byte *curshades = shadetable[GetShade(wallheight[postx])];
 #endif
 
+    if(fusedclear)
+        FillPostColumn (0, 0);          // the post may end before the view does
+
     ywcount = yd = wallheight[postx] >> 3;
     if(yd <= 0) yd = 100;
 
-    yoffs = (viewheight / 2 - ywcount) * vbufPitch;
+    yoffs = viewheight / 2 - ywcount;
     if(yoffs < 0) yoffs = 0;
-    yoffs += postx;
+    yoffs = VIEWOFS(postx, yoffs, vbufPitch);
 
     yendoffs = viewheight / 2 + ywcount - 1;
     yw=TEXTURESIZE-1;
@@ -311,7 +530,7 @@ void ScalePost()
 #else
     col = postsource[yw];
 #endif
-    yendoffs = yendoffs * vbufPitch + postx;
+    yendoffs = VIEWOFS(postx, yendoffs, vbufPitch);
     while(yoffs <= yendoffs)
     {
         vbuf[yendoffs] = col;
@@ -331,7 +550,77 @@ void ScalePost()
             col = postsource[yw];
 #endif
         }
-        yendoffs -= vbufPitch;
+        yendoffs -= VIEWYSTEP(vbufPitch);
+    }
+}
+
+void ScalePost()
+{
+    int height, count;
+    byte *dest, *texel, *src;
+    scaler_t *scaler;
+
+    height = wallheight[postx] >> 3;
+    if(height < 0 || height >= numscalers)
+    {
+        ScaleLargePost ();
+        return;
+    }
+
+    scaler = &scalers[height];
+    count = scaler->count;
+    if(fusedclear)
+        FillPostColumn (scaler->top, scaler->top + count);
+    texel = scaler->texel;
+    src = postsource;
+    dest = vbuf + VIEWOFS(postx, scaler->top, vbufPitch);
+
+    int level = 0;
+
+    if(mipmapping)
+        level = PostMipLevel(height);
+    if(level)
+    {
+        src = MipTexture(postpage, level)
+            + (((posttexture >> TEXTURESHIFT) >> level) << (TEXTURESHIFT - level));
+#ifdef USE_SHADING
+        byte *curshades = shadetable[GetShade(wallheight[postx])];
+#endif
+
+        while(count--)
+        {
+#ifdef USE_SHADING
+            *dest = curshades[src[*texel++ >> level]];
+#else
+            *dest = src[*texel++ >> level];
+#endif
+            dest += VIEWYSTEP(vbufPitch);
+        }
+        return;
+    }
+
+#ifdef USE_SHADING
+    int shade = GetShade(wallheight[postx]);
+    byte *shaded = ShadedTexture(postpage, shade);
+
+    if(shaded)
+        src = shaded + posttexture;
+    else
+    {
+        byte *curshades = shadetable[shade];
+
+        while(count--)
+        {
+            *dest = curshades[src[*texel++]];
+            dest += VIEWYSTEP(vbufPitch);
+        }
+        return;
+    }
+#endif
+    while(count--)
+    {
+        *dest = src[*texel++];
+        dest += VIEWYSTEP(vbufPitch);
     }
 }
 
@@ -377,6 +666,7 @@ void HitVertWall (void)
         ScalePost();
         wallheight[pixx] = CalcHeight();
         postsource+=texture-lasttexture;
+        posttexture=texture;
         postwidth=1;
         postx=pixx;
         lasttexture=texture;
@@ -404,7 +694,7 @@ void HitVertWall (void)
     else
         wallpic = vertwall[tilehit];
 
-    postsource = PM_GetTexture(wallpic) + texture;
+    SetPostSource(wallpic, texture);
 }
 
 
@@ -442,6 +732,7 @@ void HitHorizWall (void)
         ScalePost();
         wallheight[pixx] = CalcHeight();
         postsource+=texture-lasttexture;
+        posttexture=texture;
         postwidth=1;
         postx=pixx;
         lasttexture=texture;
@@ -469,7 +760,7 @@ void HitHorizWall (void)
     else
         wallpic = horizwall[tilehit];
 
-    postsource = PM_GetTexture(wallpic) + texture;
+    SetPostSource(wallpic, texture);
 }
 
 //==========================================================================
@@ -503,6 +794,7 @@ void HitHorizDoor (void)
         ScalePost();
         wallheight[pixx] = CalcHeight();
         postsource+=texture-lasttexture;
+        posttexture=texture;
         postwidth=1;
         postx=pixx;
         lasttexture=texture;
@@ -534,7 +826,7 @@ void HitHorizDoor (void)
             break;
     }
 
-    postsource = PM_GetTexture(doorpage) + texture;
+    SetPostSource(doorpage, texture);
 }
 
 //==========================================================================
@@ -568,6 +860,7 @@ void HitVertDoor (void)
         ScalePost();
         wallheight[pixx] = CalcHeight();
         postsource+=texture-lasttexture;
+        posttexture=texture;
         postwidth=1;
         postx=pixx;
         lasttexture=texture;
@@ -599,7 +892,7 @@ void HitVertDoor (void)
             break;
     }
 
-    postsource = PM_GetTexture(doorpage) + texture;
+    SetPostSource(doorpage, texture);
 }
 
 //==========================================================================
@@ -628,27 +921,77 @@ byte vgaCeiling[]=
 /*
 =====================
 =
-= VGAClearScreen
+= BuildClearColumn
+=
+= Sets the ceiling and floor color of every view row in clearcolumn
 =
 =====================
 */
 
-void VGAClearScreen (void)
+static void BuildClearColumn (void)
 {
     byte ceiling=vgaCeiling[gamestate.episode*10+mapon];
 
+#ifdef USE_SHADING
     int y;
+
+    for(y = 0; y < viewheight / 2; y++)
+        clearcolumn[y] = shadetable[GetShade((viewheight / 2 - y) << 3)][ceiling];
+    for(; y < viewheight; y++)
+        clearcolumn[y] = shadetable[GetShade((y - viewheight / 2) << 3)][0x19];
+#else
+    memset(clearcolumn, ceiling, viewheight / 2);
+    memset(clearcolumn + viewheight / 2, 0x19, viewheight - viewheight / 2);
+#endif
+}
+
+/*
+=====================
+=
+= CanFuseClear
+=
+= Returns true if nothing is drawn between the ceiling/floor colors and the
+= walls, so the posts can fill their columns themselves
+=
+=====================
+*/
+
+static boolean CanFuseClear (void)
+{
+#ifdef USE_FLOORCEILINGTEX
+    return false;                   // untextured tiles show the cleared colors
+#else
+    if(!param_fusedclear)
+        return false;
+#ifdef USE_FEATUREFLAGS
+    if(GetFeatureFlags() & (FF_STARSKY | FF_PARALLAXSKY | FF_CLOUDSKY))
+        return false;
+#endif
+    return true;
+#endif
+}
+
+/*
+=====================
+=
+= VGAClearScreen
+=
+=====================
+*/
+
+void VGAClearScreen (void)
+{
     byte *ptr = vbuf;
-#ifdef USE_SHADING
-    for(y = 0; y < viewheight / 2; y++, ptr += vbufPitch)
-        memset(ptr, shadetable[GetShade((viewheight / 2 - y) << 3)][ceiling], viewwidth);
-    for(; y < viewheight; y++, ptr += vbufPitch)
-        memset(ptr, shadetable[GetShade((y - viewheight / 2) << 3)][0x19], viewwidth);
+#ifdef USE_COLUMNVIEW
+    int x;
+
+    for(x = 0; x < viewwidth; x++, ptr += vbufPitch)
+        memcpy(ptr, clearcolumn, viewheight);
 #else
-    for(y = 0; y < viewheight / 2; y++, ptr += vbufPitch)
-        memset(ptr, ceiling, viewwidth);
-    for(; y < viewheight; y++, ptr += vbufPitch)
-        memset(ptr, 0x19, viewwidth);
+    int y;
+
+    for(y = 0; y < viewheight; y++, ptr += vbufPitch)
+        memset(ptr, clearcolumn[y], viewwidth);
 #endif
 }
 
@@ -669,7 +1012,7 @@ int CalcRotate (objtype *ob)
     // this isn't exactly correct, as it should vary by a trig value,
     // but it is close enough with only eight rotations
 
-    viewangle = player->angle + (centerx - ob->viewx)/8;
+    viewangle = player->angle + ((centerx - ob->viewx) << detailshift)/8;
 
     if (ob->obclass == rocketobj || ob->obclass == hrocketobj)
         angle = (viewangle-180) - ob->angle;
@@ -690,18 +1033,20 @@ int CalcRotate (objtype *ob)
 
 void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t flags)
 {
-    t_compshape *shape;
-    unsigned scale,pixheight;
-    unsigned starty,endy;
-    word *cmdptr;
-    byte *cline;
-    byte *line;
+    spriteshape_t *shape;
+    spritespan_t *cspan,*cspanend,*span;
+    byte *texels;
+    unsigned scale,pixheight,pixwidth;
+    unsigned endy;
     byte *vmem;
     int actx,i,upperedge;
-    short newstart;
     int scrstarty,screndy,lpix,rpix,pixcnt,ycnt;
     unsigned j;
     byte col;
+#ifdef USE_SPRITECOVERAGE
+    uint32_t *cov;
+    int covtop,covbottom;
+#endif
 
 #ifdef USE_SHADING
     byte *curshades;
@@ -711,43 +1056,60 @@ void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t flags)
         curshades = shadetable[GetShade(height)];
 #endif
 
-    shape = (t_compshape *) PM_GetSprite(shapenum);
+    shape = PM_GetSpriteShape(shapenum);
+    texels = (byte *) PM_GetSprite(shapenum);
 
     scale=height>>3;                 // low three bits are fractional
     if(!scale) return;   // too close or far away
 
     pixheight=scale*SPRITESCALEFACTOR;
-    actx=xcenter-scale;
+    pixwidth=pixheight>>detailshift;
+    actx=xcenter-(scale>>detailshift);
     upperedge=viewheight/2-scale;
 
-    cmdptr=(word *) shape->dataofs;
+    if((int)((shape->bottom*pixheight)>>6)+upperedge <= 0
+            || (int)((shape->top*pixheight)>>6)+upperedge >= viewheight)
+        return;                      // no opaque row on screen
+
+#ifdef USE_SPRITECOVERAGE
+    covtop=(int)((shape->top*pixheight)>>6)+upperedge;
+    covbottom=(int)((shape->bottom*pixheight)>>6)+upperedge;
+    if(covtop<0) covtop=0;
+    if(covbottom>viewheight) covbottom=viewheight;
+#endif
 
-    for(i=shape->leftpix,pixcnt=i*pixheight,rpix=(pixcnt>>6)+actx;i<=shape->rightpix;i++,cmdptr++)
+    for(i=shape->leftpix,pixcnt=i*pixwidth,rpix=(pixcnt>>6)+actx;i<=shape->rightpix;i++)
     {
         lpix=rpix;
-        if(lpix>=viewwidth) break;
-        pixcnt+=pixheight;
+        if(lpix>=stripeend) break;
+        pixcnt+=pixwidth;
         rpix=(pixcnt>>6)+actx;
-        if(lpix!=rpix && rpix>0)
+        if(lpix!=rpix && rpix>stripestart)
         {
-            if(lpix<0) lpix=0;
-            if(rpix>viewwidth) rpix=viewwidth,i=shape->rightpix+1;
-            cline=(byte *)shape + *cmdptr;
+            cspan=shape->columns[i-shape->leftpix];
+            cspanend=shape->columns[i-shape->leftpix+1];
+            if(lpix<stripestart) lpix=stripestart;
+            if(rpix>stripeend) rpix=stripeend,i=shape->rightpix+1;
             while(lpix<rpix)
             {
                 if(wallheight[lpix]<=(int)height)
                 {
-                    line=cline;
-                    while((endy = READWORD(line)) != 0)
+#ifdef USE_SPRITECOVERAGE
+                    cov=spritecoverage+lpix*coveragewords;
+                    if(RowsCovered(cov,covtop,covbottom))
                     {
-                        endy >>= 1;
-                        newstart = READWORD(line);
-                        starty = READWORD(line) >> 1;
-                        j=starty;
+                        lpix++;
+                        continue;           // nearer sprites cover all rows of the shape
+                    }
+#endif
+                    for(span=cspan;span<cspanend;span++)
+                    {
+                        endy = span->end;
+                        j=span->start;
                         ycnt=j*pixheight;
                         screndy=(ycnt>>6)+upperedge;
-                        if(screndy<0) vmem=vbuf+lpix;
-                        else vmem=vbuf+screndy*vbufPitch+lpix;
+                        if(screndy<0) vmem=vbuf+VIEWOFS(lpix,0,vbufPitch);
+                        else vmem=vbuf+VIEWOFS(lpix,screndy,vbufPitch);
                         for(;j<endy;j++)
                         {
                             scrstarty=screndy;
@@ -756,19 +1118,23 @@ void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t flags)
                             if(scrstarty!=screndy && screndy>0)
                             {
 #ifdef USE_SHADING
-                                col=curshades[((byte *)shape)[newstart+j]];
+                                col=curshades[texels[span->texofs+j]];
 #else
-                                col=((byte *)shape)[newstart+j];
+                                col=texels[span->texofs+j];
 #endif
                                 if(scrstarty<0) scrstarty=0;
                                 if(screndy>viewheight) screndy=viewheight,j=endy;
 
+#ifdef USE_SPRITECOVERAGE
+                                vmem=CoverRows(vmem,vbufPitch,cov,scrstarty,screndy,col);
+#else
                                 while(scrstarty<screndy)
                                 {
                                     *vmem=col;
-                                    vmem+=vbufPitch;
+                                    vmem+=VIEWYSTEP(vbufPitch);
                                     scrstarty++;
                                 }
+#endif
                             }
                         }
                     }
@@ -781,52 +1147,48 @@ void ScaleShape (int xcenter, int shapenum, unsigned height, uint32_t flags)
 
 void SimpleScaleShape (int xcenter, int shapenum, unsigned height)
 {
-    t_compshape   *shape;
-    unsigned scale,pixheight;
-    unsigned starty,endy;
-    word *cmdptr;
-    byte *cline;
-    byte *line;
+    spriteshape_t *shape;
+    spritespan_t *cspan,*cspanend,*span;
+    byte *texels;
+    unsigned scale,pixheight,pixwidth;
+    unsigned endy;
     int actx,i,upperedge;
-    short newstart;
     int scrstarty,screndy,lpix,rpix,pixcnt,ycnt;
     unsigned j;
     byte col;
     byte *vmem;
 
-    shape = (t_compshape *) PM_GetSprite(shapenum);
+    shape = PM_GetSpriteShape(shapenum);
+    texels = (byte *) PM_GetSprite(shapenum);
 
     scale=height>>1;
     pixheight=scale*SPRITESCALEFACTOR;
-    actx=xcenter-scale;
+    pixwidth=pixheight>>detailshift;
+    actx=xcenter-(scale>>detailshift);
     upperedge=viewheight/2-scale;
 
-    cmdptr=shape->dataofs;
-
-    for(i=shape->leftpix,pixcnt=i*pixheight,rpix=(pixcnt>>6)+actx;i<=shape->rightpix;i++,cmdptr++)
+    for(i=shape->leftpix,pixcnt=i*pixwidth,rpix=(pixcnt>>6)+actx;i<=shape->rightpix;i++)
     {
         lpix=rpix;
         if(lpix>=viewwidth) break;
-        pixcnt+=pixheight;
+        pixcnt+=pixwidth;
         rpix=(pixcnt>>6)+actx;
         if(lpix!=rpix && rpix>0)
         {
+            cspan=shape->columns[i-shape->leftpix];
+            cspanend=shape->columns[i-shape->leftpix+1];
             if(lpix<0) lpix=0;
             if(rpix>viewwidth) rpix=viewwidth,i=shape->rightpix+1;
-            cline = (byte *)shape + *cmdptr;
             while(lpix<rpix)
             {
-                line=cline;
-                while((endy = READWORD(line)) != 0)
+                for(span=cspan;span<cspanend;span++)
                 {
-                    endy >>= 1;
-                    newstart = READWORD(line);
-                    starty = READWORD(line) >> 1;
-                    j=starty;
+                    endy = span->end;
+                    j=span->start;
                     ycnt=j*pixheight;
                     screndy=(ycnt>>6)+upperedge;
-                    if(screndy<0) vmem=vbuf+lpix;
-                    else vmem=vbuf+screndy*vbufPitch+lpix;
+                    if(screndy<0) vmem=vbuf+VIEWOFS(lpix,0,vbufPitch);
+                    else vmem=vbuf+VIEWOFS(lpix,screndy,vbufPitch);
                     for(;j<endy;j++)
                     {
                         scrstarty=screndy;
@@ -834,14 +1196,14 @@ void SimpleScaleShape (int xcenter, int shapenum, unsigned height)
                         screndy=(ycnt>>6)+upperedge;
                         if(scrstarty!=screndy && screndy>0)
                         {
-                            col=((byte *)shape)[newstart+j];
+                            col=texels[span->texofs+j];
                             if(scrstarty<0) scrstarty=0;
                             if(screndy>viewheight) screndy=viewheight,j=endy;
 
                             while(scrstarty<screndy)
                             {
                                 *vmem=col;
-                                vmem+=vbufPitch;
+                                vmem+=VIEWYSTEP(vbufPitch);
                                 scrstarty++;
                             }
                         }
@@ -863,7 +1225,7 @@ void SimpleScaleShape (int xcenter, int shapenum, unsigned height)
 =====================
 */
 
-#define MAXVISABLE 250
+#define VISLISTCHUNK 256             // vislist grows by this many objects
 
 typedef struct
 {
@@ -877,28 +1239,117 @@ typedef struct
 #endif
 } visobj_t;
 
-visobj_t vislist[MAXVISABLE];
-visobj_t *visptr,*visstep,*farthest;
+visobj_t *vislist;
+visobj_t *visptr;
+int      maxvisable;
 
-void DrawScaleds (void)
+visobj_t **visorder;                    // visible objects from back to front
+visobj_t **vissorted;                   // temporary buffer for SortVisList
+int      numvisable;
+
+/*
+=====================
+=
+= GrowVisList
+=
+= Makes room for VISLISTCHUNK more visible objects
+=
+=====================
+*/
+
+void GrowVisList (void)
+{
+    maxvisable += VISLISTCHUNK;
+    vislist = (visobj_t *) realloc(vislist, maxvisable * sizeof(visobj_t));
+    CHECKMALLOCRESULT(vislist);
+    visorder = (visobj_t **) realloc(visorder, maxvisable * sizeof(visobj_t *));
+    CHECKMALLOCRESULT(visorder);
+    vissorted = (visobj_t **) realloc(vissorted, maxvisable * sizeof(visobj_t *));
+    CHECKMALLOCRESULT(vissorted);
+}
+
+/*
+=====================
+=
+= SortVisList
+=
+= Sorts the numvisable objects in vislist by viewheight into visorder with a
+= stable two pass radix sort, so objects with the same height keep the order in which
+= they were collected
+=
+=====================
+*/
+
+void SortVisList (void)
+{
+    int i, pass, count[256], pos;
+    visobj_t **src, **dest, **swap;
+
+    src = visorder;
+    dest = vissorted;
+    for (i = 0; i<numvisable; i++)
+        src[i] = &vislist[i];
+
+    for (pass = 0; pass < 16; pass += 8)
+    {
+        memset(count, 0, sizeof(count));
+        for (i = 0; i<numvisable; i++)
+            count[((word) src[i]->viewheight >> pass) & 0xff]++;
+
+        for (i = 0, pos = 0; i<256; i++)
+        {
+            int n = count[i];
+            count[i] = pos;
+            pos += n;
+        }
+
+        for (i = 0; i<numvisable; i++)
+            dest[count[((word) src[i]->viewheight >> pass) & 0xff]++] = src[i];
+
+        swap = src;
+        src = dest;
+        dest = swap;
+    }
+    // after the two passes the result is back in visorder
+}
+
+/*
+=====================
+=
+= CollectScaleds
+=
+= Places all visible objects into vislist and sorts them into visorder
+=
+=====================
+*/
+
+void CollectScaleds (void)
 {
-    int      i,least,numvisable,height;
     byte     *tilespot,*visspot;
     unsigned spotloc;
 
     statobj_t *statptr;
     objtype   *obj;
 
-    visptr = &vislist[0];
+    numvisable = 0;
 
 //
 // place static objects
 //
     for (statptr = &statobjlist[0] ; statptr !=laststatobj ; statptr++)
     {
+        if (numvisable == maxvisable)
+            GrowVisList ();
+        visptr = &vislist[numvisable];
+
         if ((visptr->shapenum = statptr->shapenum) == -1)
             continue;                                               // object has been deleted
 
+#ifdef USE_PVS
+        if (viewpvs && !INPVS(viewpvs, statptr->tilex, statptr->tiley))
+            continue;                                               // can't be seen from here
+#endif
+
         if (!*statptr->visspot)
             continue;                                               // not visable
 
@@ -920,11 +1371,8 @@ void DrawScaleds (void)
             visptr->transsprite=NULL;
 #endif
 
-        if (visptr < &vislist[MAXVISABLE-1])    // don't let it overflow
-        {
-            visptr->flags = (short) statptr->flags;
-            visptr++;
-        }
+        visptr->flags = (short) statptr->flags;
+        numvisable++;
     }
 
 //
@@ -932,9 +1380,21 @@ void DrawScaleds (void)
 //
     for (obj = player->next;obj;obj=obj->next)
     {
+        if (numvisable == maxvisable)
+            GrowVisList ();
+        visptr = &vislist[numvisable];
+
         if ((visptr->shapenum = obj->state->shapenum)==0)
             continue;                                               // no shape
 
+#ifdef USE_PVS
+        if (viewpvs && !INPVS(viewpvs, obj->tilex, obj->tiley))
+        {
+            obj->flags &= ~FL_VISABLE;                              // can't be seen from here
+            continue;
+        }
+#endif
+
         spotloc = (obj->tilex<<mapshift)+obj->tiley;   // optimize: keep in struct?
         visspot = &spotvis[0][0]+spotloc;
         tilespot = &tilemap[0][0]+spotloc;
@@ -965,14 +1425,11 @@ void DrawScaleds (void)
             if (obj->state->rotate)
                 visptr->shapenum += CalcRotate (obj);
 
-            if (visptr < &vislist[MAXVISABLE-1])    // don't let it overflow
-            {
-                visptr->flags = (short) obj->flags;
+            visptr->flags = (short) obj->flags;
 #ifdef USE_DIR3DSPR
-                visptr->transsprite = NULL;
+            visptr->transsprite = NULL;
 #endif
-                visptr++;
-            }
+            numvisable++;
             obj->flags |= FL_VISABLE;
         }
         else
@@ -980,43 +1437,62 @@ void DrawScaleds (void)
     }
 
 //
-// draw from back to front
+// sort from back to front
 //
-    numvisable = (int) (visptr-&vislist[0]);
+    SortVisList ();
 
-    if (!numvisable)
-        return;                                                                 // no visable objects
-
-    for (i = 0; i<numvisable; i++)
-    {
-        least = 32000;
-        for (visstep=&vislist[0] ; visstep<visptr ; visstep++)
-        {
-            height = visstep->viewheight;
-            if (height < least)
-            {
-                least = height;
-                farthest = visstep;
-            }
-        }
-        //
-        // draw farthest
-        //
-#ifdef USE_DIR3DSPR
-        if(farthest->transsprite)
-            Scale3DShape(vbuf, vbufPitch, farthest->transsprite);
-        else
+#ifdef USE_SPRITECOVERAGE
+    coveragewords = (viewheight + 31) >> 5;
 #endif
-            ScaleShape(farthest->viewx, farthest->shapenum, farthest->viewheight, farthest->flags);
-
-        farthest->viewheight = 32000;
-    }
 }
 
-//==========================================================================
-
 /*
-==============
+=====================
+=
+= DrawVisList
+=
+= Draws the sorted objects into the columns of the current stripe
+=
+=====================
+*/
+
+void DrawVisList (void)
+{
+    int i;
+    visobj_t *farthest;
+
+#ifdef USE_SPRITECOVERAGE
+    //
+    // draw from front to back, nearer pixels are never overwritten
+    //
+    memset(spritecoverage + stripestart * coveragewords, 0,
+        (stripeend - stripestart) * coveragewords * sizeof(uint32_t));
+
+    for (i = numvisable-1; i>=0; i--)
+#else
+    for (i = 0; i<numvisable; i++)
+#endif
+    {
+        farthest = visorder[i];
+#ifdef USE_DIR3DSPR
+        if(farthest->transsprite)
+            Scale3DShape(vbuf, vbufPitch, farthest->transsprite);
+        else
+#endif
+            ScaleShape(farthest->viewx, farthest->shapenum, farthest->viewheight, farthest->flags);
+    }
+}
+
+void DrawScaleds (void)
+{
+    CollectScaleds ();
+    DrawVisList ();
+}
+
+//==========================================================================
+
+/*
+==============
 =
 = DrawPlayerWeapon
 =
@@ -1091,173 +1567,224 @@ void CalcTics (void)
 
 //==========================================================================
 
-void AsmRefresh()
-{
-    int32_t xstep,ystep;
-    longword xpartial,ypartial;
-    boolean playerInPushwallBackTile = tilemap[focaltx][focalty] == 64;
+/*
+====================
+=
+= SetupRay
+=
+= Sets up the steps and partial distances for the ray of column pixx
+=
+====================
+*/
 
-    for(pixx=0;pixx<viewwidth;pixx++)
+static void SetupRay (void)
+{
+    short angl=midangle+pixelangle[pixx];
+    if(angl<0) angl+=FINEANGLES;
+    if(angl>=3600) angl-=FINEANGLES;
+    if(angl<900)
     {
-        short angl=midangle+pixelangle[pixx];
-        if(angl<0) angl+=FINEANGLES;
-        if(angl>=3600) angl-=FINEANGLES;
-        if(angl<900)
-        {
-            xtilestep=1;
-            ytilestep=-1;
-            xstep=finetangent[900-1-angl];
-            ystep=-finetangent[angl];
-            xpartial=xpartialup;
-            ypartial=ypartialdown;
-        }
-        else if(angl<1800)
-        {
-            xtilestep=-1;
-            ytilestep=-1;
-            xstep=-finetangent[angl-900];
-            ystep=-finetangent[1800-1-angl];
-            xpartial=xpartialdown;
-            ypartial=ypartialdown;
-        }
-        else if(angl<2700)
-        {
-            xtilestep=-1;
-            ytilestep=1;
-            xstep=-finetangent[2700-1-angl];
-            ystep=finetangent[angl-1800];
-            xpartial=xpartialdown;
-            ypartial=ypartialup;
-        }
-        else if(angl<3600)
-        {
-            xtilestep=1;
-            ytilestep=1;
-            xstep=finetangent[angl-2700];
-            ystep=finetangent[3600-1-angl];
-            xpartial=xpartialup;
-            ypartial=ypartialup;
-        }
-        yintercept=FixedMul(ystep,xpartial)+viewy;
-        xtile=focaltx+xtilestep;
-        xspot=(word)((xtile<<mapshift)+((uint32_t)yintercept>>16));
-        xintercept=FixedMul(xstep,ypartial)+viewx;
-        ytile=focalty+ytilestep;
-        yspot=(word)((((uint32_t)xintercept>>16)<<mapshift)+ytile);
-        texdelta=0;
+        xtilestep=1;
+        ytilestep=-1;
+        xstep=finetangent[900-1-angl];
+        ystep=-finetangent[angl];
+        xpartial=xpartialup;
+        ypartial=ypartialdown;
+    }
+    else if(angl<1800)
+    {
+        xtilestep=-1;
+        ytilestep=-1;
+        xstep=-finetangent[angl-900];
+        ystep=-finetangent[1800-1-angl];
+        xpartial=xpartialdown;
+        ypartial=ypartialdown;
+    }
+    else if(angl<2700)
+    {
+        xtilestep=-1;
+        ytilestep=1;
+        xstep=-finetangent[2700-1-angl];
+        ystep=finetangent[angl-1800];
+        xpartial=xpartialdown;
+        ypartial=ypartialup;
+    }
+    else if(angl<3600)
+    {
+        xtilestep=1;
+        ytilestep=1;
+        xstep=finetangent[angl-2700];
+        ystep=finetangent[3600-1-angl];
+        xpartial=xpartialup;
+        ypartial=ypartialup;
+    }
+}
+
+/*
+====================
+=
+= CastRay
+=
+= Follows the ray set up by SetupRay through the map and draws what it hits
+=
+====================
+*/
 
-        // Special treatment when player is in back tile of pushwall
-        if(playerInPushwallBackTile)
+static void CastRay (boolean playerInPushwallBackTile)
+{
+    hitface = HITFACE_NONE;
+
+    yintercept=FixedMul(ystep,xpartial)+viewy;
+    xtile=focaltx+xtilestep;
+    xspot=(word)((xtile<<mapshift)+((uint32_t)yintercept>>16));
+    xintercept=FixedMul(xstep,ypartial)+viewx;
+    ytile=focalty+ytilestep;
+    yspot=(word)((((uint32_t)xintercept>>16)<<mapshift)+ytile);
+    texdelta=0;
+
+    // Special treatment when player is in back tile of pushwall
+    if(playerInPushwallBackTile)
+    {
+        if(    pwalldir == di_east && xtilestep ==  1
+            || pwalldir == di_west && xtilestep == -1)
         {
-            if(    pwalldir == di_east && xtilestep ==  1
-                || pwalldir == di_west && xtilestep == -1)
+            int32_t yintbuf = yintercept - ((ystep * (64 - pwallpos)) >> 6);
+            if((yintbuf >> 16) == focalty)   // ray hits pushwall back?
             {
-                int32_t yintbuf = yintercept - ((ystep * (64 - pwallpos)) >> 6);
-                if((yintbuf >> 16) == focalty)   // ray hits pushwall back?
-                {
-                    if(pwalldir == di_east)
-                        xintercept = (focaltx << TILESHIFT) + (pwallpos << 10);
-                    else
-                        xintercept = (focaltx << TILESHIFT) - TILEGLOBAL + ((64 - pwallpos) << 10);
-                    yintercept = yintbuf;
-                    ytile = (short) (yintercept >> TILESHIFT);
-                    tilehit = pwalltile;
-                    HitVertWall();
-                    continue;
-                }
+                if(pwalldir == di_east)
+                    xintercept = (focaltx << TILESHIFT) + (pwallpos << 10);
+                else
+                    xintercept = (focaltx << TILESHIFT) - TILEGLOBAL + ((64 - pwallpos) << 10);
+                yintercept = yintbuf;
+                ytile = (short) (yintercept >> TILESHIFT);
+                tilehit = pwalltile;
+                HitVertWall();
+                return;
             }
-            else if(pwalldir == di_south && ytilestep ==  1
-                ||  pwalldir == di_north && ytilestep == -1)
+        }
+        else if(pwalldir == di_south && ytilestep ==  1
+            ||  pwalldir == di_north && ytilestep == -1)
+        {
+            int32_t xintbuf = xintercept - ((xstep * (64 - pwallpos)) >> 6);
+            if((xintbuf >> 16) == focaltx)   // ray hits pushwall back?
             {
-                int32_t xintbuf = xintercept - ((xstep * (64 - pwallpos)) >> 6);
-                if((xintbuf >> 16) == focaltx)   // ray hits pushwall back?
-                {
-                    xintercept = xintbuf;
-                    if(pwalldir == di_south)
-                        yintercept = (focalty << TILESHIFT) + (pwallpos << 10);
-                    else
-                        yintercept = (focalty << TILESHIFT) - TILEGLOBAL + ((64 - pwallpos) << 10);
-                    xtile = (short) (xintercept >> TILESHIFT);
-                    tilehit = pwalltile;
-                    HitHorizWall();
-                    continue;
-                }
+                xintercept = xintbuf;
+                if(pwalldir == di_south)
+                    yintercept = (focalty << TILESHIFT) + (pwallpos << 10);
+                else
+                    yintercept = (focalty << TILESHIFT) - TILEGLOBAL + ((64 - pwallpos) << 10);
+                xtile = (short) (xintercept >> TILESHIFT);
+                tilehit = pwalltile;
+                HitHorizWall();
+                return;
             }
         }
+    }
 
-        do
-        {
-            if(ytilestep==-1 && (yintercept>>16)<=ytile) goto horizentry;
-            if(ytilestep==1 && (yintercept>>16)>=ytile) goto horizentry;
+    do
+    {
+        if(ytilestep==-1 && (yintercept>>16)<=ytile) goto horizentry;
+        if(ytilestep==1 && (yintercept>>16)>=ytile) goto horizentry;
 vertentry:
-            if((uint32_t)yintercept>mapheight*65536-1 || (word)xtile>=mapwidth)
+        if((uint32_t)yintercept>mapheight*65536-1 || (word)xtile>=mapwidth)
+        {
+            if(xtile<0) xintercept=0, xtile=0;
+            else if(xtile>=mapwidth) xintercept=mapwidth<<TILESHIFT, xtile=mapwidth-1;
+            else xtile=(short) (xintercept >> TILESHIFT);
+            if(yintercept<0) yintercept=0, ytile=0;
+            else if(yintercept>=(mapheight<<TILESHIFT)) yintercept=mapheight<<TILESHIFT, ytile=mapheight-1;
+            yspot=0xffff;
+            tilehit=0;
+            HitHorizBorder();
+            break;
+        }
+        if(xspot>=maparea) break;
+        tilehit=((byte *)tilemap)[xspot];
+        if(tilehit)
+        {
+            if(tilehit&0x80)
             {
-                if(xtile<0) xintercept=0, xtile=0;
-                else if(xtile>=mapwidth) xintercept=mapwidth<<TILESHIFT, xtile=mapwidth-1;
-                else xtile=(short) (xintercept >> TILESHIFT);
-                if(yintercept<0) yintercept=0, ytile=0;
-                else if(yintercept>=(mapheight<<TILESHIFT)) yintercept=mapheight<<TILESHIFT, ytile=mapheight-1;
-                yspot=0xffff;
-                tilehit=0;
-                HitHorizBorder();
-                break;
+                int32_t yintbuf=yintercept+(ystep>>1);
+                if((yintbuf>>16)!=(yintercept>>16))
+                    goto passvert;
+                if((word)yintbuf<doorposition[tilehit&0x7f])
+                    goto passvert;
+                yintercept=yintbuf;
+                xintercept=(xtile<<TILESHIFT)|0x8000;
+                ytile = (short) (yintercept >> TILESHIFT);
+                HitVertDoor();
             }
-            if(xspot>=maparea) break;
-            tilehit=((byte *)tilemap)[xspot];
-            if(tilehit)
+            else
             {
-                if(tilehit&0x80)
-                {
-                    int32_t yintbuf=yintercept+(ystep>>1);
-                    if((yintbuf>>16)!=(yintercept>>16))
-                        goto passvert;
-                    if((word)yintbuf<doorposition[tilehit&0x7f])
-                        goto passvert;
-                    yintercept=yintbuf;
-                    xintercept=(xtile<<TILESHIFT)|0x8000;
-                    ytile = (short) (yintercept >> TILESHIFT);
-                    HitVertDoor();
-                }
-                else
+                if(tilehit==64)
                 {
-                    if(tilehit==64)
+                    if(pwalldir==di_west || pwalldir==di_east)
                     {
-                        if(pwalldir==di_west || pwalldir==di_east)
-                        {
 	                        int32_t yintbuf;
-                            int pwallposnorm;
-                            int pwallposinv;
-                            if(pwalldir==di_west)
-                            {
-                                pwallposnorm = 64-pwallpos;
-                                pwallposinv = pwallpos;
-                            }
-                            else
-                            {
-                                pwallposnorm = pwallpos;
-                                pwallposinv = 64-pwallpos;
-                            }
-                            if(pwalldir == di_east && xtile==pwallx && ((uint32_t)yintercept>>16)==pwally
-                                || pwalldir == di_west && !(xtile==pwallx && ((uint32_t)yintercept>>16)==pwally))
+                        int pwallposnorm;
+                        int pwallposinv;
+                        if(pwalldir==di_west)
+                        {
+                            pwallposnorm = 64-pwallpos;
+                            pwallposinv = pwallpos;
+                        }
+                        else
+                        {
+                            pwallposnorm = pwallpos;
+                            pwallposinv = 64-pwallpos;
+                        }
+                        if(pwalldir == di_east && xtile==pwallx && ((uint32_t)yintercept>>16)==pwally
+                            || pwalldir == di_west && !(xtile==pwallx && ((uint32_t)yintercept>>16)==pwally))
+                        {
+                            yintbuf=yintercept+((ystep*pwallposnorm)>>6);
+                            if((yintbuf>>16)!=(yintercept>>16))
+                                goto passvert;
+
+                            xintercept=(xtile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
+                            yintercept=yintbuf;
+                            ytile = (short) (yintercept >> TILESHIFT);
+                            tilehit=pwalltile;
+                            HitVertWall();
+                        }
+                        else
+                        {
+                            yintbuf=yintercept+((ystep*pwallposinv)>>6);
+                            if((yintbuf>>16)!=(yintercept>>16))
+                                goto passvert;
+
+                            xintercept=(xtile<<TILESHIFT)-(pwallposinv<<10);
+                            yintercept=yintbuf;
+                            ytile = (short) (yintercept >> TILESHIFT);
+                            tilehit=pwalltile;
+                            HitVertWall();
+                        }
+                    }
+                    else
+                    {
+                        int pwallposi = pwallpos;
+                        if(pwalldir==di_north) pwallposi = 64-pwallpos;
+                        if(pwalldir==di_south && (word)yintercept<(pwallposi<<10)
+                            || pwalldir==di_north && (word)yintercept>(pwallposi<<10))
+                        {
+                            if(((uint32_t)yintercept>>16)==pwally && xtile==pwallx)
                             {
-                                yintbuf=yintercept+((ystep*pwallposnorm)>>6);
-                                if((yintbuf>>16)!=(yintercept>>16))
+                                if(pwalldir==di_south && (int32_t)((word)yintercept)+ystep<(pwallposi<<10)
+                                        || pwalldir==di_north && (int32_t)((word)yintercept)+ystep>(pwallposi<<10))
                                     goto passvert;
 
-                                xintercept=(xtile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
-                                yintercept=yintbuf;
-                                ytile = (short) (yintercept >> TILESHIFT);
+                                if(pwalldir==di_south)
+                                    yintercept=(yintercept&0xffff0000)+(pwallposi<<10);
+                                else
+                                    yintercept=(yintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
+                                xintercept=xintercept-((xstep*(64-pwallpos))>>6);
+                                xtile = (short) (xintercept >> TILESHIFT);
                                 tilehit=pwalltile;
-                                HitVertWall();
+                                HitHorizWall();
                             }
                             else
                             {
-                                yintbuf=yintercept+((ystep*pwallposinv)>>6);
-                                if((yintbuf>>16)!=(yintercept>>16))
-                                    goto passvert;
-
-                                xintercept=(xtile<<TILESHIFT)-(pwallposinv<<10);
-                                yintercept=yintbuf;
+                                texdelta = -(pwallposi<<10);
+                                xintercept=xtile<<TILESHIFT;
                                 ytile = (short) (yintercept >> TILESHIFT);
                                 tilehit=pwalltile;
                                 HitVertWall();
@@ -1265,154 +1792,155 @@ vertentry:
                         }
                         else
                         {
-                            int pwallposi = pwallpos;
-                            if(pwalldir==di_north) pwallposi = 64-pwallpos;
-                            if(pwalldir==di_south && (word)yintercept<(pwallposi<<10)
-                                || pwalldir==di_north && (word)yintercept>(pwallposi<<10))
+                            if(((uint32_t)yintercept>>16)==pwally && xtile==pwallx)
                             {
-                                if(((uint32_t)yintercept>>16)==pwally && xtile==pwallx)
-                                {
-                                    if(pwalldir==di_south && (int32_t)((word)yintercept)+ystep<(pwallposi<<10)
-                                            || pwalldir==di_north && (int32_t)((word)yintercept)+ystep>(pwallposi<<10))
-                                        goto passvert;
-
-                                    if(pwalldir==di_south)
-                                        yintercept=(yintercept&0xffff0000)+(pwallposi<<10);
-                                    else
-                                        yintercept=(yintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
-                                    xintercept=xintercept-((xstep*(64-pwallpos))>>6);
-                                    xtile = (short) (xintercept >> TILESHIFT);
-                                    tilehit=pwalltile;
-                                    HitHorizWall();
-                                }
-                                else
-                                {
-                                    texdelta = -(pwallposi<<10);
-                                    xintercept=xtile<<TILESHIFT;
-                                    ytile = (short) (yintercept >> TILESHIFT);
-                                    tilehit=pwalltile;
-                                    HitVertWall();
-                                }
+                                texdelta = -(pwallposi<<10);
+                                xintercept=xtile<<TILESHIFT;
+                                ytile = (short) (yintercept >> TILESHIFT);
+                                tilehit=pwalltile;
+                                HitVertWall();
                             }
                             else
                             {
-                                if(((uint32_t)yintercept>>16)==pwally && xtile==pwallx)
-                                {
-                                    texdelta = -(pwallposi<<10);
-                                    xintercept=xtile<<TILESHIFT;
-                                    ytile = (short) (yintercept >> TILESHIFT);
-                                    tilehit=pwalltile;
-                                    HitVertWall();
-                                }
+                                if(pwalldir==di_south && (int32_t)((word)yintercept)+ystep>(pwallposi<<10)
+                                        || pwalldir==di_north && (int32_t)((word)yintercept)+ystep<(pwallposi<<10))
+                                    goto passvert;
+
+                                if(pwalldir==di_south)
+                                    yintercept=(yintercept&0xffff0000)-((64-pwallpos)<<10);
                                 else
-                                {
-                                    if(pwalldir==di_south && (int32_t)((word)yintercept)+ystep>(pwallposi<<10)
-                                            || pwalldir==di_north && (int32_t)((word)yintercept)+ystep<(pwallposi<<10))
-                                        goto passvert;
-
-                                    if(pwalldir==di_south)
-                                        yintercept=(yintercept&0xffff0000)-((64-pwallpos)<<10);
-                                    else
-                                        yintercept=(yintercept&0xffff0000)+((64-pwallpos)<<10);
-                                    xintercept=xintercept-((xstep*pwallpos)>>6);
-                                    xtile = (short) (xintercept >> TILESHIFT);
-                                    tilehit=pwalltile;
-                                    HitHorizWall();
-                                }
+                                    yintercept=(yintercept&0xffff0000)+((64-pwallpos)<<10);
+                                xintercept=xintercept-((xstep*pwallpos)>>6);
+                                xtile = (short) (xintercept >> TILESHIFT);
+                                tilehit=pwalltile;
+                                HitHorizWall();
                             }
                         }
                     }
-                    else
-                    {
-                        xintercept=xtile<<TILESHIFT;
-                        ytile = (short) (yintercept >> TILESHIFT);
-                        HitVertWall();
-                    }
                 }
-                break;
+                else
+                {
+                    xintercept=xtile<<TILESHIFT;
+                    ytile = (short) (yintercept >> TILESHIFT);
+                    hitface = HITFACE_VERT;
+                    HitVertWall();
+                }
             }
-passvert:
-            *((byte *)spotvis+xspot)=1;
-            xtile+=xtilestep;
-            yintercept+=ystep;
-            xspot=(word)((xtile<<mapshift)+((uint32_t)yintercept>>16));
+            break;
         }
-        while(1);
-        continue;
+passvert:
+        *((byte *)spotvis+xspot)=1;
+        xtile+=xtilestep;
+        yintercept+=ystep;
+        xspot=(word)((xtile<<mapshift)+((uint32_t)yintercept>>16));
+    }
+    while(1);
+    return;
 
-        do
-        {
-            if(xtilestep==-1 && (xintercept>>16)<=xtile) goto vertentry;
-            if(xtilestep==1 && (xintercept>>16)>=xtile) goto vertentry;
+    do
+    {
+        if(xtilestep==-1 && (xintercept>>16)<=xtile) goto vertentry;
+        if(xtilestep==1 && (xintercept>>16)>=xtile) goto vertentry;
 horizentry:
-            if((uint32_t)xintercept>mapwidth*65536-1 || (word)ytile>=mapheight)
+        if((uint32_t)xintercept>mapwidth*65536-1 || (word)ytile>=mapheight)
+        {
+            if(ytile<0) yintercept=0, ytile=0;
+            else if(ytile>=mapheight) yintercept=mapheight<<TILESHIFT, ytile=mapheight-1;
+            else ytile=(short) (yintercept >> TILESHIFT);
+            if(xintercept<0) xintercept=0, xtile=0;
+            else if(xintercept>=(mapwidth<<TILESHIFT)) xintercept=mapwidth<<TILESHIFT, xtile=mapwidth-1;
+            xspot=0xffff;
+            tilehit=0;
+            HitVertBorder();
+            break;
+        }
+        if(yspot>=maparea) break;
+        tilehit=((byte *)tilemap)[yspot];
+        if(tilehit)
+        {
+            if(tilehit&0x80)
             {
-                if(ytile<0) yintercept=0, ytile=0;
-                else if(ytile>=mapheight) yintercept=mapheight<<TILESHIFT, ytile=mapheight-1;
-                else ytile=(short) (yintercept >> TILESHIFT);
-                if(xintercept<0) xintercept=0, xtile=0;
-                else if(xintercept>=(mapwidth<<TILESHIFT)) xintercept=mapwidth<<TILESHIFT, xtile=mapwidth-1;
-                xspot=0xffff;
-                tilehit=0;
-                HitVertBorder();
-                break;
+                int32_t xintbuf=xintercept+(xstep>>1);
+                if((xintbuf>>16)!=(xintercept>>16))
+                    goto passhoriz;
+                if((word)xintbuf<doorposition[tilehit&0x7f])
+                    goto passhoriz;
+                xintercept=xintbuf;
+                yintercept=(ytile<<TILESHIFT)+0x8000;
+                xtile = (short) (xintercept >> TILESHIFT);
+                HitHorizDoor();
             }
-            if(yspot>=maparea) break;
-            tilehit=((byte *)tilemap)[yspot];
-            if(tilehit)
+            else
             {
-                if(tilehit&0x80)
-                {
-                    int32_t xintbuf=xintercept+(xstep>>1);
-                    if((xintbuf>>16)!=(xintercept>>16))
-                        goto passhoriz;
-                    if((word)xintbuf<doorposition[tilehit&0x7f])
-                        goto passhoriz;
-                    xintercept=xintbuf;
-                    yintercept=(ytile<<TILESHIFT)+0x8000;
-                    xtile = (short) (xintercept >> TILESHIFT);
-                    HitHorizDoor();
-                }
-                else
+                if(tilehit==64)
                 {
-                    if(tilehit==64)
+                    if(pwalldir==di_north || pwalldir==di_south)
                     {
-                        if(pwalldir==di_north || pwalldir==di_south)
+                        int32_t xintbuf;
+                        int pwallposnorm;
+                        int pwallposinv;
+                        if(pwalldir==di_north)
                         {
-                            int32_t xintbuf;
-                            int pwallposnorm;
-                            int pwallposinv;
-                            if(pwalldir==di_north)
-                            {
-                                pwallposnorm = 64-pwallpos;
-                                pwallposinv = pwallpos;
-                            }
-                            else
-                            {
-                                pwallposnorm = pwallpos;
-                                pwallposinv = 64-pwallpos;
-                            }
-                            if(pwalldir == di_south && ytile==pwally && ((uint32_t)xintercept>>16)==pwallx
-                                || pwalldir == di_north && !(ytile==pwally && ((uint32_t)xintercept>>16)==pwallx))
+                            pwallposnorm = 64-pwallpos;
+                            pwallposinv = pwallpos;
+                        }
+                        else
+                        {
+                            pwallposnorm = pwallpos;
+                            pwallposinv = 64-pwallpos;
+                        }
+                        if(pwalldir == di_south && ytile==pwally && ((uint32_t)xintercept>>16)==pwallx
+                            || pwalldir == di_north && !(ytile==pwally && ((uint32_t)xintercept>>16)==pwallx))
+                        {
+                            xintbuf=xintercept+((xstep*pwallposnorm)>>6);
+                            if((xintbuf>>16)!=(xintercept>>16))
+                                goto passhoriz;
+
+                            yintercept=(ytile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
+                            xintercept=xintbuf;
+                            xtile = (short) (xintercept >> TILESHIFT);
+                            tilehit=pwalltile;
+                            HitHorizWall();
+                        }
+                        else
+                        {
+                            xintbuf=xintercept+((xstep*pwallposinv)>>6);
+                            if((xintbuf>>16)!=(xintercept>>16))
+                                goto passhoriz;
+
+                            yintercept=(ytile<<TILESHIFT)-(pwallposinv<<10);
+                            xintercept=xintbuf;
+                            xtile = (short) (xintercept >> TILESHIFT);
+                            tilehit=pwalltile;
+                            HitHorizWall();
+                        }
+                    }
+                    else
+                    {
+                        int pwallposi = pwallpos;
+                        if(pwalldir==di_west) pwallposi = 64-pwallpos;
+                        if(pwalldir==di_east && (word)xintercept<(pwallposi<<10)
+                                || pwalldir==di_west && (word)xintercept>(pwallposi<<10))
+                        {
+                            if(((uint32_t)xintercept>>16)==pwallx && ytile==pwally)
                             {
-                                xintbuf=xintercept+((xstep*pwallposnorm)>>6);
-                                if((xintbuf>>16)!=(xintercept>>16))
+                                if(pwalldir==di_east && (int32_t)((word)xintercept)+xstep<(pwallposi<<10)
+                                        || pwalldir==di_west && (int32_t)((word)xintercept)+xstep>(pwallposi<<10))
                                     goto passhoriz;
 
-                                yintercept=(ytile<<TILESHIFT)+TILEGLOBAL-(pwallposinv<<10);
-                                xintercept=xintbuf;
-                                xtile = (short) (xintercept >> TILESHIFT);
+                                if(pwalldir==di_east)
+                                    xintercept=(xintercept&0xffff0000)+(pwallposi<<10);
+                                else
+                                    xintercept=(xintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
+                                yintercept=yintercept-((ystep*(64-pwallpos))>>6);
+                                ytile = (short) (yintercept >> TILESHIFT);
                                 tilehit=pwalltile;
-                                HitHorizWall();
+                                HitVertWall();
                             }
                             else
                             {
-                                xintbuf=xintercept+((xstep*pwallposinv)>>6);
-                                if((xintbuf>>16)!=(xintercept>>16))
-                                    goto passhoriz;
-
-                                yintercept=(ytile<<TILESHIFT)-(pwallposinv<<10);
-                                xintercept=xintbuf;
+                                texdelta = -(pwallposi<<10);
+                                yintercept=ytile<<TILESHIFT;
                                 xtile = (short) (xintercept >> TILESHIFT);
                                 tilehit=pwalltile;
                                 HitHorizWall();
@@ -1420,170 +1948,855 @@ horizentry:
                         }
                         else
                         {
-                            int pwallposi = pwallpos;
-                            if(pwalldir==di_west) pwallposi = 64-pwallpos;
-                            if(pwalldir==di_east && (word)xintercept<(pwallposi<<10)
-                                    || pwalldir==di_west && (word)xintercept>(pwallposi<<10))
+                            if(((uint32_t)xintercept>>16)==pwallx && ytile==pwally)
                             {
-                                if(((uint32_t)xintercept>>16)==pwallx && ytile==pwally)
-                                {
-                                    if(pwalldir==di_east && (int32_t)((word)xintercept)+xstep<(pwallposi<<10)
-                                            || pwalldir==di_west && (int32_t)((word)xintercept)+xstep>(pwallposi<<10))
-                                        goto passhoriz;
-
-                                    if(pwalldir==di_east)
-                                        xintercept=(xintercept&0xffff0000)+(pwallposi<<10);
-                                    else
-                                        xintercept=(xintercept&0xffff0000)-TILEGLOBAL+(pwallposi<<10);
-                                    yintercept=yintercept-((ystep*(64-pwallpos))>>6);
-                                    ytile = (short) (yintercept >> TILESHIFT);
-                                    tilehit=pwalltile;
-                                    HitVertWall();
-                                }
-                                else
-                                {
-                                    texdelta = -(pwallposi<<10);
-                                    yintercept=ytile<<TILESHIFT;
-                                    xtile = (short) (xintercept >> TILESHIFT);
-                                    tilehit=pwalltile;
-                                    HitHorizWall();
-                                }
+                                texdelta = -(pwallposi<<10);
+                                yintercept=ytile<<TILESHIFT;
+                                xtile = (short) (xintercept >> TILESHIFT);
+                                tilehit=pwalltile;
+                                HitHorizWall();
                             }
                             else
                             {
-                                if(((uint32_t)xintercept>>16)==pwallx && ytile==pwally)
-                                {
-                                    texdelta = -(pwallposi<<10);
-                                    yintercept=ytile<<TILESHIFT;
-                                    xtile = (short) (xintercept >> TILESHIFT);
-                                    tilehit=pwalltile;
-                                    HitHorizWall();
-                                }
+                                if(pwalldir==di_east && (int32_t)((word)xintercept)+xstep>(pwallposi<<10)
+                                        || pwalldir==di_west && (int32_t)((word)xintercept)+xstep<(pwallposi<<10))
+                                    goto passhoriz;
+
+                                if(pwalldir==di_east)
+                                    xintercept=(xintercept&0xffff0000)-((64-pwallpos)<<10);
                                 else
-                                {
-                                    if(pwalldir==di_east && (int32_t)((word)xintercept)+xstep>(pwallposi<<10)
-                                            || pwalldir==di_west && (int32_t)((word)xintercept)+xstep<(pwallposi<<10))
-                                        goto passhoriz;
-
-                                    if(pwalldir==di_east)
-                                        xintercept=(xintercept&0xffff0000)-((64-pwallpos)<<10);
-                                    else
-                                        xintercept=(xintercept&0xffff0000)+((64-pwallpos)<<10);
-                                    yintercept=yintercept-((ystep*pwallpos)>>6);
-                                    ytile = (short) (yintercept >> TILESHIFT);
-                                    tilehit=pwalltile;
-                                    HitVertWall();
-                                }
+                                    xintercept=(xintercept&0xffff0000)+((64-pwallpos)<<10);
+                                yintercept=yintercept-((ystep*pwallpos)>>6);
+                                ytile = (short) (yintercept >> TILESHIFT);
+                                tilehit=pwalltile;
+                                HitVertWall();
                             }
                         }
                     }
-                    else
-                    {
-                        yintercept=ytile<<TILESHIFT;
-                        xtile = (short) (xintercept >> TILESHIFT);
-                        HitHorizWall();
-                    }
                 }
-                break;
+                else
+                {
+                    yintercept=ytile<<TILESHIFT;
+                    xtile = (short) (xintercept >> TILESHIFT);
+                    hitface = HITFACE_HORIZ;
+                    HitHorizWall();
+                }
             }
-passhoriz:
-            *((byte *)spotvis+yspot)=1;
-            ytile+=ytilestep;
-            xintercept+=xstep;
-            yspot=(word)((((uint32_t)xintercept>>16)<<mapshift)+ytile);
+            break;
         }
-        while(1);
+passhoriz:
+        *((byte *)spotvis+yspot)=1;
+        ytile+=ytilestep;
+        xintercept+=xstep;
+        yspot=(word)((((uint32_t)xintercept>>16)<<mapshift)+ytile);
     }
+    while(1);
 }
 
+/*
+=============================================================================
+
+                               WALL SPANS
+
+ When a ray hits a plain wall face, the following columns often hit the same
+ face. If the area between the rays of two columns and the face contains no
+ solid tiles, the DDA of all columns in between would just step through empty
+ tiles to the face. So their intercepts are calculated directly with the same
+ fixed point steps the DDA would take, and their steps are only followed to
+ mark the same tiles in spotvis, without looking at the map. A full DDA only
+ runs at the span boundaries.
+
+=============================================================================
+*/
+
 /*
 ====================
 =
-= WallRefresh
+= FaceIntercept
+=
+= Calculates where the ray set up by SetupRay meets the face of tile
+= facex/facey. Returns false, if the ray doesn't hit the face at least
+= WALLSPANMARGIN away from its corners.
 =
 ====================
 */
 
-void WallRefresh (void)
-{
-    xpartialdown = viewx&(TILEGLOBAL-1);
-    xpartialup = TILEGLOBAL-xpartialdown;
-    ypartialdown = viewy&(TILEGLOBAL-1);
-    ypartialup = TILEGLOBAL-ypartialdown;
-
-    min_wallheight = viewheight;
-    lastside = -1;                  // the first pixel is on a new wall
-    AsmRefresh ();
-    ScalePost ();                   // no more optimization on last post
-}
-
-void CalcViewVariables()
+static boolean FaceIntercept (int face, int facex, int facey, int facestep,
+    fixed *hitx, fixed *hity)
 {
-    viewangle = player->angle;
-    midangle = viewangle*(FINEANGLES/ANGLES);
-    viewsin = sintable[viewangle];
-    viewcos = costable[viewangle];
-    viewx = player->x - FixedMul(focallength,viewcos);
-    viewy = player->y + FixedMul(focallength,viewsin);
-
-    focaltx = (short)(viewx>>TILESHIFT);
-    focalty = (short)(viewy>>TILESHIFT);
+    int32_t steps;
 
-    viewtx = (short)(player->x >> TILESHIFT);
-    viewty = (short)(player->y >> TILESHIFT);
+    if(face == HITFACE_VERT)
+    {
+        if(xtilestep != facestep) return false;
+        steps = (facex - focaltx - xtilestep) * xtilestep;
+        if(steps < 0) return false;
+        *hity = FixedMul(ystep,xpartial) + viewy + steps * ystep;
+        if((*hity >> TILESHIFT) != facey) return false;
+        *hitx = (facex << TILESHIFT) + (xtilestep == -1 ? TILEGLOBAL : 0);
+        return (word) *hity >= WALLSPANMARGIN && (word) *hity <= TILEGLOBAL - WALLSPANMARGIN;
+    }
+    else
+    {
+        if(ytilestep != facestep) return false;
+        steps = (facey - focalty - ytilestep) * ytilestep;
+        if(steps < 0) return false;
+        *hitx = FixedMul(xstep,ypartial) + viewx + steps * xstep;
+        if((*hitx >> TILESHIFT) != facex) return false;
+        *hity = (facey << TILESHIFT) + (ytilestep == -1 ? TILEGLOBAL : 0);
+        return (word) *hitx >= WALLSPANMARGIN && (word) *hitx <= TILEGLOBAL - WALLSPANMARGIN;
+    }
 }
 
-//==========================================================================
-
 /*
-========================
+====================
 =
-= ThreeDRefresh
+= CheckSpanArea
+=
+= Returns false, if any tile touching the triangle between the view point
+= and the face points a and b, widened by WALLSPANMARGIN, is not empty
+=
+====================
+*/
+
+static boolean CheckSpanArea (fixed ax, fixed ay, fixed bx, fixed by,
+    int face, int facex, int facey, int facestep)
+{
+    fixed px[3], py[3];
+    fixed ymin, ymax, top, bottom, xmin, xmax, y, x;
+    int i, j, k, tx, ty, txmin, txmax, tymin, tymax;
+
+    px[0] = viewx; py[0] = viewy;
+    px[1] = ax;    py[1] = ay;
+    px[2] = bx;    py[2] = by;
+
+    ymin = ymax = py[0];
+    for(i = 1; i < 3; i++)
+    {
+        if(py[i] < ymin) ymin = py[i];
+        if(py[i] > ymax) ymax = py[i];
+    }
+    tymin = (ymin - WALLSPANMARGIN) >> TILESHIFT;
+    tymax = (ymax + WALLSPANMARGIN) >> TILESHIFT;
+
+    // the face and anything behind it don't belong to the area
+    if(face == HITFACE_HORIZ)
+    {
+        if(facestep == 1 && tymax > facey - 1) tymax = facey - 1;
+        else if(facestep == -1 && tymin < facey + 1) tymin = facey + 1;
+    }
+    if(tymin < 0) tymin = 0;
+    if(tymax > MAPSIZE - 1) tymax = MAPSIZE - 1;
+
+    for(ty = tymin; ty <= tymax; ty++)
+    {
+        //
+        // find the x range of the triangle within this row of tiles
+        //
+        top = (ty << TILESHIFT) - WALLSPANMARGIN;
+        bottom = ((ty + 1) << TILESHIFT) + WALLSPANMARGIN;
+        xmin = 0x7fffffff;
+        xmax = -0x7fffffff;
+        for(i = 0; i < 3; i++)
+        {
+            if(py[i] >= top && py[i] <= bottom)
+            {
+                if(px[i] < xmin) xmin = px[i];
+                if(px[i] > xmax) xmax = px[i];
+            }
+            j = (i + 1) % 3;
+            for(k = 0; k < 2; k++)
+            {
+                y = k ? bottom : top;
+                if((py[i] < y && py[j] > y) || (py[i] > y && py[j] < y))
+                {
+                    x = px[i] + (fixed) ((int64_t) (y - py[i]) * (px[j] - px[i]) / (py[j] - py[i]));
+                    if(x < xmin) xmin = x;
+                    if(x > xmax) xmax = x;
+                }
+            }
+        }
+        if(xmin > xmax) continue;
+
+        txmin = (xmin - WALLSPANMARGIN) >> TILESHIFT;
+        txmax = (xmax + WALLSPANMARGIN) >> TILESHIFT;
+        if(face == HITFACE_VERT)
+        {
+            if(facestep == 1 && txmax > facex - 1) txmax = facex - 1;
+            else if(facestep == -1 && txmin < facex + 1) txmin = facex + 1;
+        }
+        if(txmin < 0) txmin = 0;
+        if(txmax > MAPSIZE - 1) txmax = MAPSIZE - 1;
+
+        for(tx = txmin; tx <= txmax; tx++)
+        {
+            if(tx == focaltx && ty == focalty)
+                continue;               // the rays start here
+            if(tilemap[tx][ty])
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+====================
+=
+= MarkSpanRay
+=
+= Takes the same steps as CastRay for the ray set up by SetupRay up to the
+= face of tile facex/facey and marks the tiles passed in spotvis. The tiles
+= have to be empty, which CheckSpanArea makes sure of.
+=
+====================
+*/
+
+static void MarkSpanRay (int face, int facex, int facey)
+{
+    int32_t yint = FixedMul(ystep,xpartial)+viewy;
+    int32_t xint = FixedMul(xstep,ypartial)+viewx;
+    int xt = focaltx+xtilestep;
+    int yt = focalty+ytilestep;
+    boolean vert = true;            // CastRay starts in the vertical loop
+
+    while(1)
+    {
+        if(vert)
+        {
+            if((ytilestep==-1 && (yint>>16)<=yt) || (ytilestep==1 && (yint>>16)>=yt))
+                vert = false;
+        }
+        else if((xtilestep==-1 && (xint>>16)<=xt) || (xtilestep==1 && (xint>>16)>=xt))
+            vert = true;
+
+        if(vert)
+        {
+            if(face == HITFACE_VERT && xt == facex)
+                return;
+            spotvis[xt][yint>>16] = 1;
+            xt += xtilestep;
+            yint += ystep;
+        }
+        else
+        {
+            if(face == HITFACE_HORIZ && yt == facey)
+                return;
+            spotvis[xint>>16][yt] = 1;
+            yt += ytilestep;
+            xint += xstep;
+        }
+    }
+}
+
+/*
+====================
+=
+= TraceWallSpans
+=
+= Called after the ray of column pixx hit a plain wall face. Draws as many of
+= the following columns as possible as spans of the same face and leaves
+= pixx at the last column drawn.
+=
+====================
+*/
+
+static void TraceWallSpans (void)
+{
+    int face = hitface;
+    int facex = xtile, facey = ytile;
+    int facestep = face == HITFACE_VERT ? xtilestep : ytilestep;
+    word facetile = tilehit;
+    fixed ax = xintercept, ay = yintercept, bx, by, hitx, hity;
+    int start = pixx, end, len;
+
+    // don't start a span close to a tile corner
+    if((face == HITFACE_VERT && ((word) ay < WALLSPANMARGIN || (word) ay > TILEGLOBAL - WALLSPANMARGIN))
+        || (face == HITFACE_HORIZ && ((word) ax < WALLSPANMARGIN || (word) ax > TILEGLOBAL - WALLSPANMARGIN)))
+        return;
+
+    len = WALLSPANSTEP;
+    while(len >= 2)
+    {
+        end = start + len;
+        if(end > stripeend - 1) end = stripeend - 1;
+        if(end <= start) break;
+
+        pixx = end;
+        SetupRay ();
+        if(!FaceIntercept (face, facex, facey, facestep, &bx, &by)
+            || !CheckSpanArea (ax, ay, bx, by, face, facex, facey, facestep))
+        {
+            len >>= 1;
+            continue;
+        }
+
+        for(pixx = start + 1; pixx <= end; pixx++)
+        {
+            SetupRay ();
+            if(!FaceIntercept (face, facex, facey, facestep, &hitx, &hity))
+            {
+                CastRay (false);        // rounding moved it off the span
+                continue;
+            }
+            MarkSpanRay (face, facex, facey);
+            texdelta = 0;
+            tilehit = facetile;
+            if(face == HITFACE_VERT)
+            {
+                xtile = facex;
+                ytile = facey;
+                xintercept = facex << TILESHIFT;
+                yintercept = hity;
+                HitVertWall ();
+            }
+            else
+            {
+                xtile = facex;
+                ytile = facey;
+                xintercept = hitx;
+                yintercept = facey << TILESHIFT;
+                HitHorizWall ();
+            }
+        }
+
+        start = end;
+        ax = bx;
+        ay = by;
+        len = WALLSPANSTEP;
+    }
+    pixx = start;
+}
+
+void AsmRefresh()
+{
+    boolean playerInPushwallBackTile = tilemap[focaltx][focalty] == 64;
+    boolean spans = !playerInPushwallBackTile && param_wallspans;
+
+    for(pixx=stripestart;pixx<stripeend;pixx++)
+    {
+        SetupRay ();
+        CastRay (playerInPushwallBackTile);
+        if(spans && hitface != HITFACE_NONE)
+            TraceWallSpans ();
+    }
+}
+
+/*
+====================
+=
+= WallRefresh
+=
+====================
+*/
+
+void WallRefresh (void)
+{
+    min_wallheight = viewheight;
+    lastside = -1;                  // the first pixel is on a new wall
+    lasttilehit = -1;               // and not on a door of the last stripe
+    AsmRefresh ();
+    ScalePost ();                   // no more optimization on last post
+}
+
+/*
+====================
+=
+= DrawWallStripe
+=
+= Draws walls, skies and textured floors/ceilings into the current stripe
+=
+====================
+*/
+
+void DrawWallStripe (void)
+{
+    WallRefresh ();
+
+#if defined(USE_FEATUREFLAGS) && defined(USE_PARALLAX)
+    if(GetFeatureFlags() & FF_PARALLAXSKY)
+        DrawParallax(vbuf, vbufPitch);
+#endif
+#if defined(USE_FEATUREFLAGS) && defined(USE_CLOUDSKY)
+    if(GetFeatureFlags() & FF_CLOUDSKY)
+        DrawClouds(vbuf, vbufPitch, min_wallheight);
+#endif
+#ifdef USE_FLOORCEILINGTEX
+    DrawFloorAndCeiling(vbuf, vbufPitch, min_wallheight);
+#endif
+}
+
+void CalcViewVariables()
+{
+    if(viewfineangle >= 0)
+    {
+        //
+        // interpolated refresh: blend the sines of the two neighbouring degrees
+        //
+        int frac = viewfineangle % (FINEANGLES/ANGLES);
+        int next;
+
+        viewangle = viewfineangle/(FINEANGLES/ANGLES);
+        next = viewangle + 1 < ANGLES ? viewangle + 1 : 0;
+        midangle = viewfineangle;
+        viewsin = sintable[viewangle] + (sintable[next] - sintable[viewangle]) * frac / (FINEANGLES/ANGLES);
+        viewcos = costable[viewangle] + (costable[next] - costable[viewangle]) * frac / (FINEANGLES/ANGLES);
+    }
+    else
+    {
+        viewangle = player->angle;
+        midangle = viewangle*(FINEANGLES/ANGLES);
+        viewsin = sintable[viewangle];
+        viewcos = costable[viewangle];
+    }
+    viewx = player->x - FixedMul(focallength,viewcos);
+    viewy = player->y + FixedMul(focallength,viewsin);
+
+    focaltx = (short)(viewx>>TILESHIFT);
+    focalty = (short)(viewy>>TILESHIFT);
+
+    viewtx = (short)(player->x >> TILESHIFT);
+    viewty = (short)(player->y >> TILESHIFT);
+
+    xpartialdown = viewx&(TILEGLOBAL-1);
+    xpartialup = TILEGLOBAL-xpartialdown;
+    ypartialdown = viewy&(TILEGLOBAL-1);
+    ypartialup = TILEGLOBAL-ypartialdown;
+}
+
+//==========================================================================
+
+#ifdef USE_MTRENDER
+
+/*
+=============================================================================
+
+                          MULTITHREADED RENDERING
+
+ The view is split into renderthreads vertical stripes, which are drawn in
+ parallel. The stripe borders are divisible by 4, so the post merging in the
+ Hit* functions yields exactly the same picture as a single stripe would.
+ The main thread draws the first stripe itself.
+
+=============================================================================
+*/
+
+int renderthreads = 1;
+
+static SDL_Thread *renderthread[MAXRENDERTHREADS];
+static SDL_sem    *renderstart[MAXRENDERTHREADS];
+static SDL_sem    *renderdone;
+static void      (*renderjob) (void);
+static volatile boolean renderquit;
+
+static void SetStripe (int num)
+{
+    stripestart = (viewwidth * num / renderthreads) & ~3;
+    if(num == renderthreads - 1)
+        stripeend = viewwidth;
+    else
+        stripeend = (viewwidth * (num + 1) / renderthreads) & ~3;
+}
+
+static int RenderThread (void *data)
+{
+    int num = (int) (intptr_t) data;
+
+    while(1)
+    {
+        SDL_SemWait(renderstart[num]);
+        if(renderquit)
+            break;
+
+        SetStripe(num);
+        renderjob();
+        SDL_SemPost(renderdone);
+    }
+    return 0;
+}
+
+/*
+====================
+=
+= RunRenderJob
+=
+= Calls job for every stripe and waits until all stripes are done
+=
+====================
+*/
+
+static void RunRenderJob (void (*job) (void))
+{
+    int i;
+
+    renderjob = job;
+    for(i = 1; i < renderthreads; i++)
+        SDL_SemPost(renderstart[i]);
+
+    SetStripe(0);
+    job();
+
+    for(i = 1; i < renderthreads; i++)
+        SDL_SemWait(renderdone);
+
+    stripestart = 0;
+    stripeend = viewwidth;
+}
+
+void StartRenderThreads (void)
+{
+    int i;
+
+    renderthreads = param_renderthreads;
+    if(renderthreads <= 1)
+    {
+        renderthreads = 1;
+        return;
+    }
+
+    renderquit = false;
+    renderdone = SDL_CreateSemaphore(0);
+    if(!renderdone)
+        Quit("Unable to create render semaphore: %s", SDL_GetError());
+
+    for(i = 1; i < renderthreads; i++)
+    {
+        renderstart[i] = SDL_CreateSemaphore(0);
+        if(!renderstart[i])
+            Quit("Unable to create render semaphore: %s", SDL_GetError());
+        renderthread[i] = SDL_CreateThread(RenderThread, (void *) (intptr_t) i);
+        if(!renderthread[i])
+            Quit("Unable to create render thread: %s", SDL_GetError());
+    }
+}
+
+void ShutdownRenderThreads (void)
+{
+    int i;
+
+    if(renderthreads <= 1)
+        return;
+
+    renderquit = true;
+    for(i = 1; i < renderthreads; i++)
+    {
+        if(renderthread[i])
+        {
+            SDL_SemPost(renderstart[i]);
+            SDL_WaitThread(renderthread[i], NULL);
+            renderthread[i] = NULL;
+        }
+        if(renderstart[i])
+        {
+            SDL_DestroySemaphore(renderstart[i]);
+            renderstart[i] = NULL;
+        }
+    }
+    SDL_DestroySemaphore(renderdone);
+    renderdone = NULL;
+    renderthreads = 1;
+}
+
+#endif
+
+//==========================================================================
+
+#ifdef USE_COLUMNVIEW
+
+/*
+========================
+=
+= TransposeView
+=
+= Copies the column-major 3D view in columnbuffer to the row-major dest in
+= blocks of 8x8 pixels, so both the reads and the writes stay in the cache
+=
+========================
+*/
+
+void TransposeView (byte *dest, unsigned destPitch)
+{
+    int x, y, bx, by, fullrows;
+    byte *src, *dst;
+
+    fullrows = viewheight & ~7;
+
+    for(by = 0; by < fullrows; by += 8)
+    {
+        src = columnbuffer + by;
+        dst = dest + by * destPitch;
+        for(bx = 0; bx < viewwidth; bx += 8, src += 8 * vbufPitch, dst += 8)
+        {
+#ifdef TRANSPOSEMMX
+            __m64 t0, t1, t2, t3, t4, t5, t6, t7;
+            __m64 u0, u1, u2, u3, u4, u5, u6, u7;
+
+            t0 = *(__m64 *) (src);
+            t1 = *(__m64 *) (src + vbufPitch);
+            t2 = *(__m64 *) (src + 2 * vbufPitch);
+            t3 = *(__m64 *) (src + 3 * vbufPitch);
+            t4 = *(__m64 *) (src + 4 * vbufPitch);
+            t5 = *(__m64 *) (src + 5 * vbufPitch);
+            t6 = *(__m64 *) (src + 6 * vbufPitch);
+            t7 = *(__m64 *) (src + 7 * vbufPitch);
+
+            // interleave bytes of column pairs
+            u0 = _mm_unpacklo_pi8(t0, t1);
+            u1 = _mm_unpackhi_pi8(t0, t1);
+            u2 = _mm_unpacklo_pi8(t2, t3);
+            u3 = _mm_unpackhi_pi8(t2, t3);
+            u4 = _mm_unpacklo_pi8(t4, t5);
+            u5 = _mm_unpackhi_pi8(t4, t5);
+            u6 = _mm_unpacklo_pi8(t6, t7);
+            u7 = _mm_unpackhi_pi8(t6, t7);
+
+            // interleave words of column quads
+            t0 = _mm_unpacklo_pi16(u0, u2);
+            t1 = _mm_unpackhi_pi16(u0, u2);
+            t2 = _mm_unpacklo_pi16(u1, u3);
+            t3 = _mm_unpackhi_pi16(u1, u3);
+            t4 = _mm_unpacklo_pi16(u4, u6);
+            t5 = _mm_unpackhi_pi16(u4, u6);
+            t6 = _mm_unpacklo_pi16(u5, u7);
+            t7 = _mm_unpackhi_pi16(u5, u7);
+
+            // and finally the dwords, giving one row each
+            *(__m64 *) (dst)                 = _mm_unpacklo_pi32(t0, t4);
+            *(__m64 *) (dst + destPitch)     = _mm_unpackhi_pi32(t0, t4);
+            *(__m64 *) (dst + 2 * destPitch) = _mm_unpacklo_pi32(t1, t5);
+            *(__m64 *) (dst + 3 * destPitch) = _mm_unpackhi_pi32(t1, t5);
+            *(__m64 *) (dst + 4 * destPitch) = _mm_unpacklo_pi32(t2, t6);
+            *(__m64 *) (dst + 5 * destPitch) = _mm_unpackhi_pi32(t2, t6);
+            *(__m64 *) (dst + 6 * destPitch) = _mm_unpacklo_pi32(t3, t7);
+            *(__m64 *) (dst + 7 * destPitch) = _mm_unpackhi_pi32(t3, t7);
+#else
+            for(y = 0; y < 8; y++)
+            {
+                byte *s = src + y;
+                byte *d = dst + y * destPitch;
+                for(x = 0; x < 8; x++, s += vbufPitch)
+                    d[x] = *s;
+            }
+#endif
+        }
+    }
+#ifdef TRANSPOSEMMX
+    _mm_empty();
+#endif
+
+    //
+    // the remaining rows, as viewheight only has to be even
+    //
+    for(y = fullrows; y < viewheight; y++)
+    {
+        src = columnbuffer + y;
+        dst = dest + y * destPitch;
+        for(x = 0; x < viewwidth; x++, src += vbufPitch)
+            dst[x] = *src;
+    }
+}
+
+#endif
+
+//==========================================================================
+
+/*
+=============================================================================
+
+                            DYNAMIC RESOLUTION
+
+ With --framebudget, the 3D view is drawn at renderlevel/RENDERLEVELS of
+ the view window size into renderbuffer and scaled up to the window. In low
+ detail, the width is halved once more, so every column is drawn twice. After
+ every RESWINDOW frames the level is adjusted by the average drawing time:
+ it goes down as soon as the average exceeds the budget, but only goes up
+ again after two windows in a row in which the next level is expected to
+ stay below 80% of the budget, so it doesn't swing back and forth.
+
+=============================================================================
+*/
+
+#define RENDERLEVELS    8
+#define MINRENDERLEVEL  4
+#define RESWINDOW       16
+
+int renderlevel = RENDERLEVELS;
+
+static byte    *renderbuffer;           // row-major view before scaling
+static uint32_t restime;                // drawing time of the current window in ms
+static int      resframes, resraise;
+
+/*
+========================
+=
+= SelectRenderSize
+=
+= Returns the size to draw the view at for the current level and detail
+=
+========================
+*/
+
+static void SelectRenderSize (int *width, int *height, int *shift)
+{
+    // demos draw the same on every machine
+    if(!param_framebudget || demoplayback || demorecord)
+        renderlevel = RENDERLEVELS;
+    // --lowdetail overrides the menu setting without ending up in the config
+    *shift = (lowdetail || param_lowdetail) && !demoplayback && !demorecord;
+
+    if(renderlevel == RENDERLEVELS && !*shift)
+    {
+        *width = viewwidth;
+        *height = viewheight;
+        return;
+    }
+
+    if(!renderbuffer)
+    {
+        renderbuffer = (byte *) malloc(screenWidth * screenHeight);
+        CHECKMALLOCRESULT(renderbuffer);
+    }
+    *width = ((viewwidth * renderlevel / RENDERLEVELS) >> *shift) & ~15;
+    *height = (viewheight * renderlevel / RENDERLEVELS) & ~1;
+}
+
+/*
+========================
+=
+= UpdateRenderLevel
+=
+========================
+*/
+
+static void UpdateRenderLevel (uint32_t frametime)
+{
+    int32_t average;
+
+    restime += frametime;
+    if(++resframes < RESWINDOW)
+        return;
+
+    average = restime * 1000 / RESWINDOW;   // in microseconds like the budget
+    restime = 0;
+    resframes = 0;
+
+    if(average > param_framebudget)
+    {
+        resraise = 0;
+        if(renderlevel > MINRENDERLEVEL)
+            renderlevel--;
+    }
+    else if(renderlevel < RENDERLEVELS
+        && average * (renderlevel + 1) * (renderlevel + 1)
+            < param_framebudget / 5 * 4 * renderlevel * renderlevel)
+    {
+        // the drawing time grows with the number of pixels
+        if(++resraise == 2)
+        {
+            resraise = 0;
+            renderlevel++;
+        }
+    }
+    else
+        resraise = 0;
+}
+
+//==========================================================================
+
+/*
+========================
+=
+= ThreeDRefresh
 =
 ========================
 */
 
 void    ThreeDRefresh (void)
 {
+    uint32_t refreshstart = SDL_GetTicks();
+    int      fullwidth = viewwidth, fullheight = viewheight;
+    int      width, height, shift;
+    boolean  scaled;
+
+//
+// switch to the size of the current resolution level and detail
+//
+    SelectRenderSize (&width, &height, &shift);
+    scaled = width != fullwidth || height != fullheight;
+    if(width != renderwidth || height != renderheight || shift != detailshift)
+        SetRenderSize (width, height, shift);
+    else
+    {
+        viewwidth = width;
+        viewheight = height;
+    }
+
 //
 // clear out the traced array
 //
     memset(spotvis,0,maparea);
     spotvis[player->tilex][player->tiley] = 1;       // Detect all sprites over player fix
 
-    vbuf = VL_LockSurface(screenBuffer);
-    vbuf+=screenofs;
-    vbufPitch = bufferPitch;
+#ifdef USE_COLUMNVIEW
+    vbuf = columnbuffer;
+    vbufPitch = (viewheight + 15) & ~15;    // keeps the columns 8 byte aligned
+#else
+    if(scaled)
+    {
+        vbuf = renderbuffer;
+        vbufPitch = screenWidth;
+    }
+    else
+    {
+        vbuf = VL_LockSurface(screenBuffer);
+        vbuf+=screenofs;
+        vbufPitch = bufferPitch;
+    }
+#endif
 
     CalcViewVariables();
+#ifdef USE_PVS
+    viewpvs = TilePVS (focaltx, focalty);
+#endif
+    stripestart = 0;
+    stripeend = viewwidth;
 
 //
 // follow the walls from there to the right, drawing as we go
 //
-    VGAClearScreen ();
+    BuildClearColumn ();
+    fusedclear = CanFuseClear ();
+    if(!fusedclear)
+        VGAClearScreen ();
 #if defined(USE_FEATUREFLAGS) && defined(USE_STARSKY)
     if(GetFeatureFlags() & FF_STARSKY)
         DrawStarSky(vbuf, vbufPitch);
 #endif
-
-    WallRefresh ();
-
-#if defined(USE_FEATUREFLAGS) && defined(USE_PARALLAX)
-    if(GetFeatureFlags() & FF_PARALLAXSKY)
-        DrawParallax(vbuf, vbufPitch);
-#endif
 #if defined(USE_FEATUREFLAGS) && defined(USE_CLOUDSKY)
     if(GetFeatureFlags() & FF_CLOUDSKY)
-        DrawClouds(vbuf, vbufPitch, min_wallheight);
+        MoveClouds();
 #endif
-#ifdef USE_FLOORCEILINGTEX
-    DrawFloorAndCeiling(vbuf, vbufPitch, min_wallheight);
+
+#ifdef USE_MTRENDER
+    if(renderthreads > 1)
+    {
+        RunRenderJob (DrawWallStripe);
+
+        //
+        // the objects can only be collected after all stripes have filled spotvis
+        //
+        CollectScaleds ();
+        RunRenderJob (DrawVisList);
+    }
+    else
 #endif
+    {
+        DrawWallStripe ();
 
 //
 // draw all the scaled images
 //
-    DrawScaleds();                  // draw scaled stuff
+        DrawScaleds();              // draw scaled stuff
+    }
 
 #if defined(USE_FEATUREFLAGS) && defined(USE_RAIN)
     if(GetFeatureFlags() & FF_RAIN)
@@ -1594,8 +2807,28 @@ void    ThreeDRefresh (void)
         DrawSnow(vbuf, vbufPitch);
 #endif
 
+    fusedclear = false;     // wl_debug draws posts of its own
     DrawPlayerWeapon ();    // draw player's hands
 
+#ifdef USE_COLUMNVIEW
+    if(scaled)
+        TransposeView (renderbuffer, screenWidth);
+    else
+        TransposeView (VL_LockSurface(screenBuffer) + screenofs, bufferPitch);
+#endif
+    if(scaled)
+    {
+        VL_ScaleBuffer (renderbuffer, screenWidth, viewwidth, viewheight,
+            VL_LockSurface(screenBuffer) + screenofs, bufferPitch, fullwidth, fullheight);
+    }
+    viewwidth = fullwidth;
+    viewheight = fullheight;
+
+    PM_NextFrame ();        // the pages of this frame stay, older ones may go
+
+    if(param_framebudget && !demoplayback && !demorecord)
+        UpdateRenderLevel (SDL_GetTicks() - refreshstart);
+
     if(Keyboard[sc_Tab] && viewsize == 21 && gamestate.weapon != -1)
         ShowActStatus();
 
@@ -1626,8 +2859,7 @@ void    ThreeDRefresh (void)
             US_Print(" fps");
         }
 #endif
-        SDL_BlitSurface(screenBuffer, NULL, screen, NULL);
-        SDL_Flip(screen);
+        VL_QueueScreen(screenBuffer);
     }
 
 #ifndef REMDEBUG
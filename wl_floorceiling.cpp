@@ -4,82 +4,189 @@
 
 #include "wl_def.h"
 #include "wl_shade.h"
+#include "wl_mipmap.h"
 
 // Textured Floor and Ceiling by DarkOne
 // With multi-textured floors and ceilings stored in lower and upper bytes of
 // according tile in third mapplane, respectively.
+// Only the columns of the current render stripe are drawn.
+//
+// Every row is split into spans not covered by walls and every span into
+// runs of pixels within the same map tile, so the map and texture lookups
+// are only done once per run instead of once per pixel.
+// With mipmapping, every row uses the mip level matching its texel step.
+
+/*
+===================
+=
+= TileRun
+=
+= Returns the number of steps of size d from g until g>>TILESHIFT changes
+=
+===================
+*/
+
+static int TileRun(fixed g, fixed d)
+{
+    fixed edge;
+
+    if(d > 0)
+    {
+        edge = ((g >> TILESHIFT) + 1) << TILESHIFT;
+        return (edge - g + d - 1) / d;
+    }
+    else if(d < 0)
+    {
+        edge = (g >> TILESHIFT) << TILESHIFT;
+        return (g - edge) / -d + 1;
+    }
+    return 0x7fffffff;
+}
+
+// texshift, texmask and colshift describe the mip level of the current row
+#define FLOORTEXOFFS(gu, gv) \
+    (((((gu) >> texshift) & texmask) << colshift) \
+    + texmask - (((gv) >> texshift) & texmask))
+
 void DrawFloorAndCeiling(byte *vbuf, unsigned vbufPitch, int min_wallheight)
 {
     fixed dist;                                // distance to row projection
     fixed tex_step;                            // global step per one screen pixel
     fixed gu, gv, du, dv;                      // global texture coordinates
-    int u, v;                                  // local texture coordinates
     byte *toptex, *bottex;
     unsigned lasttoptex = 0xffffffff, lastbottex = 0xffffffff;
+    int x, spanend, run, runv;
+    int level, lastlevel = 0;
+    int texshift = TILESHIFT - TEXTURESHIFT, colshift = TEXTURESHIFT;
+    unsigned texmask = TEXTURESIZE - 1;
 
     int halfheight = viewheight >> 1;
     int y0 = min_wallheight >> 3;              // starting y value
     if(y0 > halfheight)
         return;                                // view obscured by walls
     if(!y0) y0 = 1;                            // don't let division by zero
-    unsigned bot_offset0 = vbufPitch * (halfheight + y0);
-    unsigned top_offset0 = vbufPitch * (halfheight - y0 - 1);
+    unsigned bot_offset0 = VIEWOFS(0, halfheight + y0, vbufPitch);
+    unsigned top_offset0 = VIEWOFS(0, halfheight - y0 - 1, vbufPitch);
+    unsigned xstep = VIEWXSTEP(vbufPitch), ystep = VIEWYSTEP(vbufPitch);
 
     // draw horizontal lines
     for(int y = y0, bot_offset = bot_offset0, top_offset = top_offset0;
-        y < halfheight; y++, bot_offset += vbufPitch, top_offset -= vbufPitch)
+        y < halfheight; y++, bot_offset += ystep, top_offset -= ystep)
     {
         dist = (heightnumerator / (y + 1)) << 5;
-        gu =  viewx + FixedMul(dist, viewcos);
-        gv = -viewy + FixedMul(dist, viewsin);
         tex_step = (dist << 8) / viewwidth / 175;
         du =  FixedMul(tex_step, viewsin);
         dv = -FixedMul(tex_step, viewcos);
-        gu -= (viewwidth >> 1) * du;
-        gv -= (viewwidth >> 1) * dv; // starting point (leftmost)
+
+        //
+        // use the mip level with texels of about the step size
+        //
+        level = 0;
+        if(mipmapping)
+        {
+            while(level < MIPLEVELS && tex_step >= (GLOBAL1 >> (TEXTURESHIFT - level - 1)))
+                level++;
+        }
+        if(level != lastlevel)
+        {
+            lastlevel = level;
+            texshift = TILESHIFT - TEXTURESHIFT + level;
+            texmask = (TEXTURESIZE >> level) - 1;
+            colshift = TEXTURESHIFT - level;
+            lasttoptex = lastbottex = 0xffffffff;
+        }
 #ifdef USE_SHADING
         byte *curshades = shadetable[GetShade(y << 3)];
 #endif
-        for(int x = 0, bot_add = bot_offset, top_add = top_offset;
-            x < viewwidth; x++, bot_add++, top_add++)
+        for(x = stripestart; x < stripeend; x = spanend)
         {
-            if(wallheight[x] >> 3 <= y)
+            //
+            // find the next span of columns not covered by walls
+            //
+            while(x < stripeend && wallheight[x] >> 3 > y)
+                x++;
+            if(x == stripeend)
+                break;
+            spanend = x + 1;
+            while(spanend < stripeend && wallheight[spanend] >> 3 <= y)
+                spanend++;
+
+            gu =  viewx + FixedMul(dist, viewcos) - ((viewwidth >> 1) - x) * du;
+            gv = -viewy + FixedMul(dist, viewsin) - ((viewwidth >> 1) - x) * dv;
+            byte *top = vbuf + top_offset + x * xstep;
+            byte *bot = vbuf + bot_offset + x * xstep;
+
+            while(x < spanend)
             {
+                //
+                // draw the pixels until the span leaves the current tile
+                //
+                run = TileRun(gu, du);
+                runv = TileRun(gv, dv);
+                if(runv < run) run = runv;
+                if(run > spanend - x) run = spanend - x;
+                x += run;
+
                 int curx = (gu >> TILESHIFT) & (MAPSIZE - 1);
                 int cury = (-(gv >> TILESHIFT) - 1) & (MAPSIZE - 1);
                 unsigned curtex = MAPSPOT(curx, cury, 2);
-                if(curtex)
+                unsigned curtoptex = curtex >> 8;
+                unsigned curbottex = curtex & 0xff;
+                if(curtoptex && curtoptex != lasttoptex)
                 {
-                    unsigned curtoptex = curtex >> 8;
-                    if (curtoptex != lasttoptex)
+                    lasttoptex = curtoptex;
+                    toptex = MipTexture(curtoptex, level);
+                }
+                if(curbottex && curbottex != lastbottex)
+                {
+                    lastbottex = curbottex;
+                    bottex = MipTexture(curbottex, level);
+                }
+
+                if(curtoptex && curbottex)
+                {
+                    for(; run > 0; run--, gu += du, gv += dv, top += xstep, bot += xstep)
                     {
-                        lasttoptex = curtoptex;
-                        toptex = PM_GetTexture(curtoptex);
+                        unsigned texoffs = FLOORTEXOFFS(gu, gv);
+#ifdef USE_SHADING
+                        *top = curshades[toptex[texoffs]];
+                        *bot = curshades[bottex[texoffs]];
+#else
+                        *top = toptex[texoffs];
+                        *bot = bottex[texoffs];
+#endif
                     }
-                    unsigned curbottex = curtex & 0xff;
-                    if (curbottex != lastbottex)
+                }
+                else if(curtoptex)
+                {
+                    for(; run > 0; run--, gu += du, gv += dv, top += xstep, bot += xstep)
                     {
-                        lastbottex = curbottex;
-                        bottex = PM_GetTexture(curbottex);
+#ifdef USE_SHADING
+                        *top = curshades[toptex[FLOORTEXOFFS(gu, gv)]];
+#else
+                        *top = toptex[FLOORTEXOFFS(gu, gv)];
+#endif
                     }
-                    u = (gu >> (TILESHIFT - TEXTURESHIFT)) & (TEXTURESIZE - 1);
-                    v = (gv >> (TILESHIFT - TEXTURESHIFT)) & (TEXTURESIZE - 1);
-                    unsigned texoffs = (u << TEXTURESHIFT) + (TEXTURESIZE - 1) - v;
+                }
+                else if(curbottex)
+                {
+                    for(; run > 0; run--, gu += du, gv += dv, top += xstep, bot += xstep)
+                    {
 #ifdef USE_SHADING
-                    if(curtoptex)
-                        vbuf[top_add] = curshades[toptex[texoffs]];
-                    if(curbottex)
-                        vbuf[bot_add] = curshades[bottex[texoffs]];
+                        *bot = curshades[bottex[FLOORTEXOFFS(gu, gv)]];
 #else
-                    if(curtoptex)
-                        vbuf[top_add] = toptex[texoffs];
-                    if(curbottex)
-                        vbuf[bot_add] = bottex[texoffs];
+                        *bot = bottex[FLOORTEXOFFS(gu, gv)];
 #endif
+                    }
+                }
+                else
+                {
+                    gu += run * du;
+                    gv += run * dv;
+                    top += run * xstep;
+                    bot += run * xstep;
                 }
             }
-            gu += du;
-            gv += dv;
         }
     }
 }
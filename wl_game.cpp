@@ -1,7 +1,16 @@
 // WL_GAME.C
 
 #include <math.h>
+#if defined(_XBOX)
+#include <xtl.h>
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
 #include "wl_def.h"
+#include "wl_pvs.h"
 #include <SDL_mixer.h>
 #pragma hdrstop
 
@@ -620,6 +629,87 @@ static void ScanInfoPlane(void)
 
 //==========================================================================
 
+/*
+==================
+=
+= PrefetchLevel
+=
+= Has the wall, door and floor textures of the level and the sprites of its
+= statics and actors loaded in the background, while the level starts
+=
+==================
+*/
+
+static void PrefetchStates (statetype *state)
+{
+    statetype *first = state;
+    int n,i;
+
+    //
+    // follow the state chain until it loops back to the first state
+    //
+    for (n = 0; state && n < 32; n++)
+    {
+        if (state->shapenum >= 0)
+        {
+            for (i = 0; i < (state->rotate == 1 ? 8 : 1); i++)
+                PM_PrefetchPage (PMSpriteStart + state->shapenum + i);
+        }
+        state = state->next;
+        if (state == first)
+            break;
+    }
+}
+
+static void PrefetchLevel (void)
+{
+    int        x,y,i;
+    byte       tile;
+    statobj_t  *statptr;
+    objtype    *ob;
+
+    for (x = 0; x < mapwidth; x++)
+    {
+        for (y = 0; y < mapheight; y++)
+        {
+            tile = tilemap[x][y];
+            if (tile && tile < MAXWALLTILES)
+            {
+                PM_PrefetchPage (horizwall[tile]);
+                PM_PrefetchPage (vertwall[tile]);
+            }
+#ifdef USE_FLOORCEILINGTEX
+            PM_PrefetchPage (MAPSPOT(x,y,2) >> 8);
+            PM_PrefetchPage (MAPSPOT(x,y,2) & 0xff);
+#endif
+        }
+    }
+
+    if (lastdoorobj != doorobjlist)
+    {
+        for (i = 0; i < 8; i++)
+            PM_PrefetchPage (PMSpriteStart - 8 + i);    // DOORWALL
+    }
+
+    for (statptr = statobjlist; statptr != laststatobj; statptr++)
+    {
+        if (statptr->shapenum >= 0)
+            PM_PrefetchPage (PMSpriteStart + statptr->shapenum);
+    }
+
+    for (ob = player; ob; ob = ob->next)
+    {
+        if (ob->state)
+            PrefetchStates (ob->state);
+    }
+
+    for (i = SPR_KNIFEREADY; i <= SPR_CHAINATK4; i++)
+        PM_PrefetchPage (PMSpriteStart + i);
+
+    PM_StartPrefetch ();
+}
+
+
 /*
 ==================
 =
@@ -774,11 +864,20 @@ void SetupGameLevel (void)
     }
 
 
+#ifdef USE_PVS
+//
+// load or build the visibility sets now that the doors and walls are final
+//
+    SetupPVS (gamestate.mapon+10*gamestate.episode);
+#endif
+
 //
 // have the caching manager load and purge stuff to make sure all marks
 // are in memory
 //
     CA_LoadAllSounds ();
+
+    PrefetchLevel ();
 }
 
 
@@ -1211,6 +1310,128 @@ void PlayDemo (int demonumber)
 
 //==========================================================================
 
+/*
+==================
+=
+= TimeDemo
+=
+= Plays back a demo as fast as possible (see PollControls) and reports
+= the frame time statistics on stdout and in timedemo.txt
+=
+==================
+*/
+
+boolean timedemo;
+
+static uint32_t *timedemoframes;            // in microseconds
+static int32_t  numtimedemoframes, maxtimedemoframes;
+
+/*
+==================
+=
+= TimeDemoClock
+=
+= Returns a running time in microseconds for timing frames, SDL_GetTicks
+= only counts whole milliseconds. Differences stay right across a wrap.
+=
+==================
+*/
+
+uint32_t TimeDemoClock (void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER count;
+
+    if(!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&count);
+    return (uint32_t) (count.QuadPart / frequency.QuadPart * 1000000
+        + count.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint32_t) tv.tv_sec * 1000000 + (uint32_t) tv.tv_usec;
+#endif
+}
+
+void TimeDemoFrame (uint32_t frametime)
+{
+    if(numtimedemoframes == maxtimedemoframes)
+    {
+        maxtimedemoframes = maxtimedemoframes ? maxtimedemoframes * 2 : 1024;
+        timedemoframes = (uint32_t *) realloc(timedemoframes, maxtimedemoframes * sizeof(uint32_t));
+        CHECKMALLOCRESULT(timedemoframes);
+    }
+    timedemoframes[numtimedemoframes++] = frametime;
+}
+
+static int CompareFrameTimes (const void *a, const void *b)
+{
+    uint32_t ta = *(const uint32_t *) a, tb = *(const uint32_t *) b;
+    return ta < tb ? -1 : ta > tb;
+}
+
+// nearest-rank percentile of the sorted frame times in milliseconds
+static double FrameTimePercentile (int percent)
+{
+    int32_t rank = (percent * numtimedemoframes + 99) / 100;
+    if(rank < 1) rank = 1;
+    return timedemoframes[rank - 1] / 1000.0;
+}
+
+void TimeDemo (int demonumber)
+{
+    char path[300];
+    uint32_t start, total;
+
+    numtimedemoframes = 0;
+    timedemo = true;
+    start = TimeDemoClock();
+    PlayDemo (demonumber);
+    total = TimeDemoClock() - start;        // the whole run, not only the refreshes
+    timedemo = false;
+
+    if(!numtimedemoframes)
+        return;
+    if(!total) total = 1;
+
+    qsort(timedemoframes, numtimedemoframes, sizeof(uint32_t), CompareFrameTimes);
+
+    double timems = total / 1000.0;
+    double p50 = FrameTimePercentile(50);
+    double p95 = FrameTimePercentile(95);
+    double p99 = FrameTimePercentile(99);
+    double maxtime = timedemoframes[numtimedemoframes - 1] / 1000.0;
+    double avgfps = numtimedemoframes * 1000000.0 / total;
+
+    printf("timedemo %i: %i frames, %.1f ms, %.1f fps\n"
+           "frame times (ms): p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+           demonumber, numtimedemoframes, timems, avgfps, p50, p95, p99, maxtime);
+
+    if(configdir[0])
+        snprintf(path, sizeof(path), "%s/timedemo.txt", configdir);
+    else
+        strcpy(path, "timedemo.txt");
+
+    FILE *file = fopen(path, "w");
+    if(file)
+    {
+        fprintf(file, "demo %i\nres %ux%u\nviewsize %i\nframes %i\ntime_ms %.3f\n"
+                      "avg_fps %.2f\np50_ms %.3f\np95_ms %.3f\np99_ms %.3f\nmax_ms %.3f\n",
+                demonumber, screenWidth, screenHeight, viewsize, numtimedemoframes,
+                timems, avgfps, p50, p95, p99, maxtime);
+        fclose(file);
+    }
+
+    free(timedemoframes);
+    timedemoframes = NULL;
+    maxtimedemoframes = 0;
+}
+
+//==========================================================================
+
 /*
 ==================
 =
@@ -9,6 +9,9 @@
 #include "wl_def.h"
 #pragma hdrstop
 #include "wl_atmos.h"
+#include "wl_pvs.h"
+#include "wl_shade.h"
+#include "wl_mipmap.h"
 #include <SDL_syswm.h>
 
 
@@ -61,6 +64,10 @@ unsigned screenofs;
 int      viewscreenx, viewscreeny;
 int      viewwidth;
 int      viewheight;
+int      renderwidth;          // size and detail the projection is set up for
+int      renderheight;
+int      detailshift;          // 1 while drawing every column twice (low detail)
+boolean  lowdetail;
 short    centerx;
 int      shootdelta;           // pixels away from centerx a target can be
 fixed    scale;
@@ -102,6 +109,27 @@ int     param_audiobuffer = 2048 / (44100 / param_samplerate);
 int     param_mission = 0;
 boolean param_goodtimes = false;
 boolean param_ignorenumchunks = false;
+boolean param_mappages = true;
+int     param_pagebudget = 0;       // in KB, 0 keeps all pages in memory
+boolean param_prefetch = true;
+boolean param_wallspans = true;
+boolean param_fusedclear = true;
+boolean param_interpolate = false;
+boolean param_asyncpresent = false;
+int     param_framebudget = 0;      // in microseconds, 0 draws the view at full size
+boolean param_lowdetail = false;
+boolean param_mipmaps = false;
+#ifdef USE_SHADING
+int     param_shadecache = 1024;    // in KB, 0 disables the pre-shaded wall textures
+#endif
+int     param_timedemo = -1;            // default is not to benchmark a demo
+#ifdef CA_BENCHMARKS
+boolean param_huffbench = false;
+boolean param_mapbench = false;
+#endif
+#ifdef USE_MTRENDER
+int     param_renderthreads = 1;
+#endif
 
 /*
 =============================================================================
@@ -172,6 +200,7 @@ void ReadConfig(void)
 
         read(file,&viewsize,sizeof(viewsize));
         read(file,&mouseadjustment,sizeof(mouseadjustment));
+        read(file,&lowdetail,sizeof(lowdetail));    // missing in older config files
 
         close(file);
 
@@ -198,6 +227,8 @@ void ReadConfig(void)
         if(mouseadjustment<0) mouseadjustment=0;
         else if(mouseadjustment>9) mouseadjustment=9;
 
+        if(lowdetail) lowdetail=true;
+
         if(viewsize<4) viewsize=4;
         else if(viewsize>21) viewsize=21;
 
@@ -289,6 +320,7 @@ void WriteConfig(void)
 
         write(file,&viewsize,sizeof(viewsize));
         write(file,&mouseadjustment,sizeof(mouseadjustment));
+        write(file,&lowdetail,sizeof(lowdetail));
 
         close(file);
     }
@@ -674,9 +706,19 @@ boolean LoadTheGame(FILE *file,int x,int y)
 
 void ShutdownId (void)
 {
+#ifdef USE_MTRENDER
+    ShutdownRenderThreads ();
+#endif
     US_Shutdown ();         // This line is completely useless...
     SD_Shutdown ();
+    FreeMipmaps ();
     PM_Shutdown ();
+#ifdef USE_PVS
+    FreePVS ();
+#endif
+#ifdef USE_SHADING
+    ShutdownShadedTextures ();
+#endif
     IN_Shutdown ();
     VW_Shutdown ();
     CA_Shutdown ();
@@ -775,7 +817,7 @@ void CalcProjection (int32_t focal)
     // divide heightnumerator by a posts distance to get the posts height for
     // the heightbuffer.  The pixel height is height>>2
     //
-    heightnumerator = (TILEGLOBAL*scale)>>6;
+    heightnumerator = (TILEGLOBAL*(scale<<detailshift))>>6;
 
     //
     // calculate the angle offset from view angle of each pixel's ray
@@ -1032,6 +1074,7 @@ void InitDigiMap (void)
         DigiMap[map[0]] = map[1];
         DigiChannel[map[1]] = map[2];
         SD_PrepareSound(map[1]);
+        PM_NextFrame();
     }
 }
 
@@ -1253,6 +1296,8 @@ static void InitGame()
     VH_Startup ();
     IN_Startup ();
     PM_Startup ();
+    if (param_mipmaps)
+        BuildMipmaps ();
     SD_Startup ();
     CA_Startup ();
     US_Startup ();
@@ -1317,6 +1362,9 @@ static void InitGame()
     LoadLatchMem ();
     BuildTables ();          // trig tables
     SetupWalls ();
+#ifdef USE_MTRENDER
+    StartRenderThreads ();
+#endif
 
     NewViewSize (viewsize);
 
@@ -1345,25 +1393,53 @@ static void InitGame()
 ==========================
 */
 
-boolean SetViewSize (unsigned width, unsigned height)
+/*
+==========================
+=
+= SetRenderSize
+=
+= Sets up the projection for drawing the 3D view at the given size, which
+= is the view window size except while ThreeDRefresh draws at a lower
+= resolution for --framebudget or low detail. With shift 1, the pixels are
+= twice as wide as high.
+=
+==========================
+*/
+
+void SetRenderSize (unsigned width, unsigned height, int shift)
 {
-    viewwidth = width&~15;                  // must be divisable by 16
-    viewheight = height&~1;                 // must be even
+    viewwidth = renderwidth = width;
+    viewheight = renderheight = height;
+    detailshift = shift;
     centerx = viewwidth/2-1;
     shootdelta = viewwidth/10;
-    if((unsigned) viewheight == screenHeight)
+
+//
+// calculate trace angles and projection constants
+//
+    CalcProjection (FOCALLENGTH);
+
+//
+// the post scalers depend on the view height
+//
+    BuildScalers ();
+}
+
+
+boolean SetViewSize (unsigned width, unsigned height)
+{
+    width &= ~15;                           // must be divisable by 16
+    height &= ~1;                           // must be even
+    if(height == screenHeight)
         viewscreenx = viewscreeny = screenofs = 0;
     else
     {
-        viewscreenx = (screenWidth-viewwidth) / 2;
-        viewscreeny = (screenHeight-scaleFactor*STATUSLINES-viewheight)/2;
+        viewscreenx = (screenWidth-width) / 2;
+        viewscreeny = (screenHeight-scaleFactor*STATUSLINES-height)/2;
         screenofs = viewscreeny*screenWidth+viewscreenx;
     }
 
-//
-// calculate trace angles and projection constants
-//
-    CalcProjection (FOCALLENGTH);
+    SetRenderSize (width, height, 0);
 
     return true;
 }
@@ -1539,6 +1615,35 @@ static void DemoLoop()
         Quit (NULL);
     }
 
+//
+// benchmark a demo and exit
+//
+    if (param_timedemo != -1)
+    {
+        TimeDemo(param_timedemo);
+        Quit (NULL);
+    }
+
+#ifdef CA_BENCHMARKS
+//
+// check and benchmark the graphics decompression and exit
+//
+    if (param_huffbench)
+    {
+        CA_HuffBenchmark ();
+        Quit (NULL);
+    }
+
+//
+// check and benchmark the map decompression and exit
+//
+    if (param_mapbench)
+    {
+        CA_MapBenchmark ();
+        Quit (NULL);
+    }
+#endif
+
 
 //
 // main game cycle
@@ -1707,6 +1812,37 @@ void CheckParameters(int argc, char *argv[])
             }
             else param_tedlevel = atoi(argv[i]);
         }
+#ifdef CA_BENCHMARKS
+        else IFARG("--huffbench")
+            param_huffbench = true;
+        else IFARG("--mapbench")
+            param_mapbench = true;
+#endif
+        else IFARG("--timedemo")
+        {
+            if(++i >= argc)
+            {
+                printf("The timedemo option is missing the demo argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_timedemo = atoi(argv[i]);
+#ifndef SPEARDEMO
+                if(param_timedemo < 0 || param_timedemo > 3)
+                {
+                    printf("The timedemo option must be between 0 and 3!\n");
+                    hasError = true;
+                }
+#else
+                if(param_timedemo != 0)
+                {
+                    printf("The timedemo option must be 0!\n");
+                    hasError = true;
+                }
+#endif
+            }
+        }
         else IFARG("--windowed")
             fullscreen = false;
         else IFARG("--windowed-mouse")
@@ -1869,10 +2005,98 @@ void CheckParameters(int argc, char *argv[])
                 }
             }
         }
+#ifdef USE_MTRENDER
+        else IFARG("--renderthreads")
+        {
+            if(++i >= argc)
+            {
+                printf("The renderthreads option is missing the count argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_renderthreads = atoi(argv[i]);
+                if(param_renderthreads < 1 || param_renderthreads > MAXRENDERTHREADS)
+                {
+                    printf("The renderthreads option must be between 1 and %i!\n", MAXRENDERTHREADS);
+                    hasError = true;
+                }
+            }
+        }
+#endif
         else IFARG("--goodtimes")
             param_goodtimes = true;
         else IFARG("--ignorenumchunks")
             param_ignorenumchunks = true;
+        else IFARG("--nommap")
+            param_mappages = false;
+        else IFARG("--noprefetch")
+            param_prefetch = false;
+        else IFARG("--pagebudget")
+        {
+            if(++i >= argc)
+            {
+                printf("The pagebudget option is missing the size argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_pagebudget = atoi(argv[i]);
+                if(param_pagebudget < 0)
+                {
+                    printf("The pagebudget size must be positive!\n");
+                    hasError = true;
+                }
+            }
+        }
+        else IFARG("--nowallspans")
+            param_wallspans = false;
+        else IFARG("--nofusedclear")
+            param_fusedclear = false;
+        else IFARG("--interpolate")
+            param_interpolate = true;
+        else IFARG("--asyncpresent")
+            param_asyncpresent = true;
+#ifdef USE_SHADING
+        else IFARG("--shadecache")
+        {
+            if(++i >= argc)
+            {
+                printf("The shadecache option is missing the size argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_shadecache = atoi(argv[i]);
+                if(param_shadecache < 0)
+                {
+                    printf("The shadecache size must be positive!\n");
+                    hasError = true;
+                }
+            }
+        }
+#endif
+        else IFARG("--lowdetail")
+            param_lowdetail = true;
+        else IFARG("--mipmaps")
+            param_mipmaps = true;
+        else IFARG("--framebudget")
+        {
+            if(++i >= argc)
+            {
+                printf("The framebudget option is missing the ms argument!\n");
+                hasError = true;
+            }
+            else
+            {
+                param_framebudget = (int) (atof(argv[i]) * 1000);
+                if(param_framebudget < 0)
+                {
+                    printf("The frame budget must be positive!\n");
+                    hasError = true;
+                }
+            }
+        }
         else IFARG("--help")
             showHelp = true;
         else hasError = true;
@@ -1893,6 +2117,14 @@ void CheckParameters(int argc, char *argv[])
             " --normal               Sets the difficulty to normal for tedlevel\n"
             " --hard                 Sets the difficulty to hard for tedlevel\n"
             " --nowait               Skips intro screens\n"
+            " --timedemo <demo>      Plays the given demo as fast as possible and writes\n"
+            "                        frame time statistics to timedemo.txt\n"
+#ifdef CA_BENCHMARKS
+            " --huffbench            Checks the graphics decompression against the\n"
+            "                        original decoder, prints its speed and exits\n"
+            " --mapbench             Checks the map decompression against the original\n"
+            "                        expanders, prints their speed and exits\n"
+#endif
             " --windowed[-mouse]     Starts the game in a window [and grabs mouse]\n"
             " --res <width> <height> Sets the screen resolution\n"
             "                        (must be multiple of 320x200 or 320x240)\n"
@@ -1912,6 +2144,31 @@ void CheckParameters(int argc, char *argv[])
             "                        (given in bytes, default: 2048 / (44100 / samplerate))\n"
             " --ignorenumchunks      Ignores the number of chunks in VGAHEAD.*\n"
             "                        (may be useful for some broken mods)\n"
+            " --nommap               Reads the whole VSWAP file into memory instead of\n"
+            "                        mapping it and loading the pages on demand\n"
+            " --pagebudget <kb>      Loads the VSWAP pages on demand and frees the least\n"
+            "                        recently used ones above the given size\n"
+            " --noprefetch           Doesn't load the pages a level needs in the\n"
+            "                        background while it starts\n"
+            " --nowallspans          Casts a full ray for every column instead of\n"
+            "                        drawing runs of columns on the same wall face\n"
+            " --nofusedclear         Clears the whole 3D view before drawing the walls\n"
+            "                        instead of filling each wall column top to bottom\n"
+            " --interpolate          Runs the game logic in single tics and draws as many\n"
+            "                        frames in between as possible (not used for demos)\n"
+            " --asyncpresent         Converts and flips the game view in a separate thread\n"
+            "                        while the next frame is drawn\n"
+            " --lowdetail            Draws every column of the 3D view twice\n"
+            " --mipmaps              Uses downsampled wall and floor textures for distant\n"
+            "                        surfaces to reduce shimmering\n"
+#ifdef USE_SHADING
+            " --shadecache <kb>      Memory for pre-shaded wall textures (default: 1024)\n"
+#endif
+            " --framebudget <ms>     Lowers the resolution of the 3D view down to half\n"
+            "                        the window size to keep drawing below ms (e.g. 8.3)\n"
+#ifdef USE_MTRENDER
+            " --renderthreads <n>    Draws the 3D view in n parallel stripes (default: 1)\n"
+#endif
             " --configdir <dir>      Directory where config file and save games are stored\n"
 #if defined(_arch_dreamcast) || defined(_WIN32)
             "                        (default: current directory)\n"
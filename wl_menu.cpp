@@ -2821,6 +2821,7 @@ int
 CP_ChangeView (int)
 {
     int exit = 0, oldview, newview;
+    boolean olddetail = lowdetail;
     ControlInfo ci;
 
     WindowX = WindowY = 0;
@@ -2864,10 +2865,19 @@ CP_ChangeView (int)
                 break;
         }
 
+        if (ci.button2 || Keyboard[sc_Space])
+        {
+            lowdetail = !lowdetail;
+            DrawChangeView (newview);
+            SD_PlaySound (HITWALLSND);
+            WaitKeyUp ();
+        }
+
         if (ci.button0 || Keyboard[sc_Enter])
             exit = 1;
         else if (ci.button1 || Keyboard[sc_Escape])
         {
+            lowdetail = olddetail;
             SD_PlaySound (ESCPRESSEDSND);
             MenuFadeOut ();
             if(screenHeight % 200 != 0)
@@ -2916,8 +2926,8 @@ DrawChangeView (int view)
     SETFONTCOLOR (HIGHLIGHT, BKGDCOLOR);
 
     US_CPrint (STR_SIZE1 "\n");
-    US_CPrint (STR_SIZE2 "\n");
-    US_CPrint (STR_SIZE3);
+    US_CPrint (lowdetail ? STR_LODETAIL "\n" : STR_HIDETAIL "\n");
+    US_CPrint (STR_SIZE2 ", " STR_SIZE3);
 #endif
     VW_UpdateScreen ();
 }
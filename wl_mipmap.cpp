@@ -0,0 +1,141 @@
+// WL_MIPMAP.C
+
+#include "wl_def.h"
+#include "wl_mipmap.h"
+
+/*
+=============================================================================
+
+                                 GLOBALS
+
+=============================================================================
+*/
+
+boolean  mipmapping;
+byte   **mippages;                  // level 1 and lower of every texture page
+unsigned mipoffset[MIPLEVELS + 1];  // offset of every level in mippages[page]
+
+/*
+=============================================================================
+
+                                 LOCALS
+
+=============================================================================
+*/
+
+static int nummippages;
+
+
+/*
+===================
+=
+= DownsampleTexture
+=
+= Averages each 2x2 block of the size x size source texture in RGB and maps
+= the result back to the nearest color of the game palette
+=
+===================
+*/
+
+static void DownsampleTexture (byte *src, int size, byte *dest)
+{
+    int half = size >> 1;
+    int x, y, i;
+    unsigned red, green, blue;
+    SDL_Color *col;
+    byte *texel;
+
+    for (x = 0; x < half; x++)
+    {
+        for (y = 0; y < half; y++)
+        {
+            texel = src + (x << 1) * size + (y << 1);
+            red = green = blue = 2;                 // round to nearest
+            for (i = 0; i < 4; i++)
+            {
+                col = &gamepal[texel[(i >> 1) * size + (i & 1)]];
+                red += col->r;
+                green += col->g;
+                blue += col->b;
+            }
+            *dest++ = VL_FindColor ((byte) (red >> 2), (byte) (green >> 2),
+                (byte) (blue >> 2));
+        }
+    }
+}
+
+
+/*
+===================
+=
+= BuildMipmaps
+=
+= Builds the mip chains of all wall and floor texture pages, must be called
+= after PM_Startup
+=
+===================
+*/
+
+void BuildMipmaps (void)
+{
+    int      page, level, size;
+    unsigned total;
+    byte    *mip;
+
+    FreeMipmaps ();
+    VL_SetFindColorPalette (gamepal);
+
+    total = 0;
+    for (level = 1; level <= MIPLEVELS; level++)
+    {
+        mipoffset[level] = total;
+        size = TEXTURESIZE >> level;
+        total += size * size;
+    }
+
+    nummippages = PMSpriteStart;
+    mippages = (byte **) calloc (nummippages, sizeof (*mippages));
+    CHECKMALLOCRESULT (mippages);
+
+    for (page = 0; page < nummippages; page++)
+    {
+        if (PM_GetPageSize (page) < TEXTURESIZE * TEXTURESIZE)
+            continue;                               // empty page, stays unfiltered
+
+        mip = (byte *) malloc (total);
+        CHECKMALLOCRESULT (mip);
+        mippages[page] = mip;
+
+        DownsampleTexture (PM_GetTexture (page), TEXTURESIZE, mip);
+        for (level = 2; level <= MIPLEVELS; level++)
+            DownsampleTexture (mip + mipoffset[level - 1], TEXTURESIZE >> (level - 1),
+                mip + mipoffset[level]);
+        PM_NextFrame ();
+    }
+
+    mipmapping = true;
+}
+
+
+/*
+===================
+=
+= FreeMipmaps
+=
+===================
+*/
+
+void FreeMipmaps (void)
+{
+    int page;
+
+    mipmapping = false;
+    if (!mippages)
+        return;
+
+    for (page = 0; page < nummippages; page++)
+        free (mippages[page]);
+    free (mippages);
+    mippages = NULL;
+    nummippages = 0;
+}
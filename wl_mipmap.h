@@ -0,0 +1,26 @@
+#ifndef _WL_MIPMAP_H_
+#define _WL_MIPMAP_H_
+
+//
+// Every wall and floor texture page gets a chain of downsampled copies,
+// level n being TEXTURESIZE>>n texels square and stored column-major like
+// the page itself. The smallest level is 4x4 texels.
+//
+#define MIPLEVELS   (TEXTURESHIFT - 2)
+
+extern boolean  mipmapping;
+extern byte   **mippages;
+extern unsigned mipoffset[MIPLEVELS + 1];
+
+void BuildMipmaps (void);
+void FreeMipmaps (void);
+
+// Returns level 0 to MIPLEVELS of the given texture page
+static inline byte *MipTexture (int page, int level)
+{
+    if (!level || page >= PMSpriteStart || !mippages[page])
+        return PM_GetTexture(page);
+    return mippages[page] + mipoffset[level];
+}
+
+#endif
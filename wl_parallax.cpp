@@ -40,7 +40,7 @@ void DrawParallax(byte *vbuf, unsigned vbufPitch)
 
     startpage += USE_PARALLAX - 1;
 
-    for(int x = 0; x < viewwidth; x++)
+    for(int x = stripestart; x < stripeend; x++)
     {
         int curang = pixelangle[x] + midangle;
         if(curang < 0) curang += FINEANGLES;
@@ -56,7 +56,7 @@ void DrawParallax(byte *vbuf, unsigned vbufPitch)
         int yend = skyheight - (wallheight[x] >> 3);
         if(yend <= 0) continue;
 
-        for(int y = 0, offs = x; y < yend; y++, offs += vbufPitch)
+        for(int y = 0, offs = VIEWOFS(x, 0, vbufPitch); y < yend; y++, offs += VIEWYSTEP(vbufPitch))
             vbuf[offs] = skytex[texoffs + (y * TEXTURESIZE) / skyheight];
     }
 }
@@ -85,6 +85,14 @@ boolean buttonstate[NUMBUTTONS];
 
 int lastgamemusicoffset = 0;
 
+//
+// interpolated rendering (--interpolate)
+//
+static boolean interpolating;               // game logic runs in single tics
+static int32_t lerpx[MAXACTORS], lerpy[MAXACTORS];  // positions before the last tic
+static boolean lerpvalid[MAXACTORS];
+static short   lerpangle;                   // player angle before the last tic
+
 
 //===========================================================================
 
@@ -410,7 +418,9 @@ void PollControls (void)
 //
 // get timing info for last frame
 //
-    if (demoplayback || demorecord)   // demo recording and playback needs to be constant
+    if (demoplayback && timedemo)     // benchmark: constant tics, but don't wait for them
+        tics = DEMOTICS;
+    else if (demoplayback || demorecord)   // demo recording and playback needs to be constant
     {
         // wait up to DEMOTICS Wolf tics
         uint32_t curtime = SDL_GetTicks();
@@ -424,6 +434,8 @@ void PollControls (void)
 
         tics = DEMOTICS;
     }
+    else if (interpolating)
+        tics = 1;                           // SimulateTics advances one tic at a time
     else
         CalcTics ();
 
@@ -850,6 +862,7 @@ void GetNewActor (void)
 
     newobj->active = ac_no;
     lastobj = newobj;
+    lerpvalid[newobj - objlist] = false;    // don't slide in from the last user of the slot
 
     objcount++;
 }
@@ -965,6 +978,12 @@ void ContinueMusic (int offs)
 SDL_Color redshifts[NUMREDSHIFTS][256];
 SDL_Color whiteshifts[NUMWHITESHIFTS][256];
 
+// the shifted palettes converted to the screen format, so shifting is just
+// a matter of presenting with another LUT
+uint32_t redshiftluts[NUMREDSHIFTS][256];
+uint32_t whiteshiftluts[NUMWHITESHIFTS][256];
+uint32_t gamepallut[256];
+
 int damagecount, bonuscount;
 boolean palshifted;
 
@@ -1020,6 +1039,12 @@ void InitRedShifts (void)
             workptr++;
         }
     }
+
+    for (i = 0; i < NUMREDSHIFTS; i++)
+        VL_BuildPaletteLUT (redshifts[i], redshiftluts[i]);
+    for (i = 0; i < NUMWHITESHIFTS; i++)
+        VL_BuildPaletteLUT (whiteshifts[i], whiteshiftluts[i]);
+    VL_BuildPaletteLUT (gamepal, gamepallut);
 }
 
 
@@ -1106,17 +1131,17 @@ void UpdatePaletteShifts (void)
 
     if (red)
     {
-        VL_SetPalette (redshifts[red - 1], false);
+        VL_SetPaletteLUT (redshifts[red - 1], redshiftluts[red - 1], false);
         palshifted = true;
     }
     else if (white)
     {
-        VL_SetPalette (whiteshifts[white - 1], false);
+        VL_SetPaletteLUT (whiteshifts[white - 1], whiteshiftluts[white - 1], false);
         palshifted = true;
     }
     else if (palshifted)
     {
-        VL_SetPalette (gamepal, false);        // back to normal
+        VL_SetPaletteLUT (gamepal, gamepallut, false);     // back to normal
         palshifted = false;
     }
 }
@@ -1137,7 +1162,7 @@ void FinishPaletteShifts (void)
     if (palshifted)
     {
         palshifted = 0;
-        VL_SetPalette (gamepal, true);
+        VL_SetPaletteLUT (gamepal, gamepallut, true);
     }
 }
 
@@ -1257,6 +1282,145 @@ think:
 //==========================================================================
 
 
+/*
+===================
+=
+= MoveWorld
+=
+= Runs the game logic for the current tics
+=
+===================
+*/
+
+static void MoveWorld (void)
+{
+    madenoise = false;
+
+    MoveDoors ();
+    MovePWalls ();
+
+    for (obj = player; obj; obj = obj->next)
+        DoActor (obj);
+}
+
+
+/*
+===================
+=
+= SimulateTics
+=
+= Runs the game logic once for every tic passed since the last call and
+= returns how far the current tic has progressed (0 to GLOBAL1-1).
+= tics is left at the number of tics simulated, which may be 0.
+=
+===================
+*/
+
+static fixed SimulateTics (void)
+{
+    uint32_t curtime = SDL_GetTicks();
+    int32_t  curtic = (curtime * 7) / 100;
+    unsigned simulated = 0;
+
+    if (lasttimecount > curtic)
+        lasttimecount = curtic;             // if the game was paused a LONG time
+    if (curtic - lasttimecount > MAXTICS)
+        lasttimecount = curtic - MAXTICS;
+
+    while (lasttimecount < curtic && !playstate && !startgame)
+    {
+        int32_t i;
+
+        for (obj = player; obj; obj = obj->next)
+        {
+            i = (int32_t) (obj - objlist);
+            lerpx[i] = obj->x;
+            lerpy[i] = obj->y;
+            lerpvalid[i] = true;
+        }
+        lerpangle = player->angle;
+
+        lasttimecount++;
+        PollControls ();
+        MoveWorld ();
+        simulated++;
+    }
+    lasttimecount = curtic;
+
+    if (!simulated)
+        IN_ProcessEvents ();
+
+    tics = simulated;
+    return (fixed) ((((curtime * 7) % 100) << 16) / 100);
+}
+
+
+/*
+===================
+=
+= LerpCoord
+=
+===================
+*/
+
+static int32_t LerpCoord (int32_t from, int32_t to, fixed frac)
+{
+    if (abs (to - from) > TILEGLOBAL)
+        return to;                          // teleported, don't slide across the map
+
+    return from + FixedMul (to - from, frac);
+}
+
+
+/*
+===================
+=
+= InterpolatedRefresh
+=
+= Draws the player and the actors frac of the way between their positions
+= before and after the last tic
+=
+===================
+*/
+
+static void InterpolatedRefresh (fixed frac)
+{
+    static int32_t savedx[MAXACTORS], savedy[MAXACTORS];
+    objtype *ob;
+    int32_t i, delta;
+
+    for (ob = player; ob; ob = ob->next)
+    {
+        i = (int32_t) (ob - objlist);
+        savedx[i] = ob->x;
+        savedy[i] = ob->y;
+        if (lerpvalid[i])
+        {
+            ob->x = LerpCoord (lerpx[i], ob->x, frac);
+            ob->y = LerpCoord (lerpy[i], ob->y, frac);
+        }
+    }
+
+    delta = player->angle - lerpangle;
+    if (delta > ANGLES / 2)
+        delta -= ANGLES;
+    else if (delta < -ANGLES / 2)
+        delta += ANGLES;
+    viewfineangle = (lerpangle * (FINEANGLES / ANGLES)
+        + ((delta * (FINEANGLES / ANGLES) * frac) >> 16) + FINEANGLES) % FINEANGLES;
+
+    ThreeDRefresh ();
+
+    viewfineangle = -1;
+    for (ob = player; ob; ob = ob->next)
+    {
+        i = (int32_t) (ob - objlist);
+        ob->x = savedx[i];
+        ob->y = savedy[i];
+    }
+}
+
+
 /*
 ===================
 =
@@ -1269,6 +1433,8 @@ int32_t funnyticount;
 
 void PlayLoop (void)
 {
+    PM_FinishPrefetch ();       // whatever isn't loaded yet is loaded on first use
+
 #if defined(USE_FEATUREFLAGS) && defined(USE_CLOUDSKY)
     if(GetFeatureFlags() & FF_CLOUDSKY)
         InitSky();
@@ -1293,24 +1459,41 @@ void PlayLoop (void)
     if (demoplayback)
         IN_StartAck ();
 
+    //
+    // demos keep the original timing, so they play back the same everywhere
+    //
+    interpolating = param_interpolate && !demoplayback && !demorecord;
+    memset (lerpvalid, 0, sizeof (lerpvalid));
+    lerpangle = player->angle;
+
     do
     {
-        PollControls ();
+        uint32_t framestart = timedemo ? TimeDemoClock () : 0;
+
+        if (interpolating)
+        {
+            fixed frac = SimulateTics ();
+
+            UpdatePaletteShifts ();
+
+            InterpolatedRefresh (frac);
+        }
+        else
+        {
+            PollControls ();
 
 //
 // actor thinking
 //
-        madenoise = false;
+            MoveWorld ();
 
-        MoveDoors ();
-        MovePWalls ();
+            UpdatePaletteShifts ();
 
-        for (obj = player; obj; obj = obj->next)
-            DoActor (obj);
-
-        UpdatePaletteShifts ();
+            ThreeDRefresh ();
+        }
 
-        ThreeDRefresh ();
+        if (timedemo)
+            TimeDemoFrame (TimeDemoClock () - framestart);
 
         //
         // MAKE FUNNY FACE IF BJ DOESN'T MOVE FOR AWHILE
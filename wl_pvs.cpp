@@ -0,0 +1,773 @@
+#include "version.h"
+
+#ifdef USE_PVS
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+#include "wl_def.h"
+#include "wl_pvs.h"
+
+// Potentially visible sets by tile
+//
+// For every tile the player can stand in, the set of tiles which can be seen
+// from anywhere inside it is built once per map. Doors are treated as open
+// and pushwalls as empty, so the sets stay valid for the whole level.
+//
+// The empty tiles are split into rectangular cells joined by portals, the
+// parts of the cell borders shared with other cells. Lines of sight are
+// followed from every tile through the portals, and every portal passed is
+// clipped to the lines which can come from the tile through the portals
+// before it. The clipping is conservative and lets lines cut corners by a
+// quarter tile, as the ray caster and CheckLine step in fixed point and can
+// slip past a corner, so a set may hold too many tiles but never misses one.
+// The sets are widened by two tiles, which covers the walls hit, the tiles
+// marked by the wall spans and the nine tiles checked around every actor.
+//
+// The sets are saved to pvs??.<extension> in the config directory and reused
+// as long as the walls of the map are the same.
+
+#define PVSVERSION  2
+#define PVSEPSILON  (1.0 / 4)       // how far lines may cut corners, in tiles
+#define PVSMAXPOINTS 32             // corners of a clipped source area
+
+typedef struct
+{
+    char     id[4];
+    word     version;
+    word     numsets;
+    uint32_t solid[PVSSETWORDS];
+} pvsheader_t;
+
+typedef struct
+{
+    byte x1, y1, x2, y2;            // tiles covered, inclusive
+    int  firstportal, numportals;   // portals leading out of the cell
+} pvscell_t;
+
+typedef struct
+{
+    double x1, y1, x2, y2;          // end points in tiles, equal for corners
+    double nx, ny;                  // unit normal pointing into the next cell
+    int    cell;                    // cell the portal leads into
+} pvsportal_t;
+
+typedef struct
+{
+    double a, b, c;                 // a*x + b*y + c >= 0, (a, b) unit length
+} pvsplane_t;
+
+typedef struct
+{
+    int    numpoints;
+    double x[PVSMAXPOINTS], y[PVSMAXPOINTS];
+} pvsarea_t;
+
+word      pvsindex[MAPSIZE][MAPSIZE];
+uint32_t *pvssets;
+uint32_t *viewpvs;                  // set of the focal tile, CollectScaleds culls with it
+
+static int      numpvssets;
+static uint32_t pvssolid[PVSSETWORDS];
+
+static word        pvscellof[MAPSIZE][MAPSIZE];
+static pvscell_t  *pvscells;
+static pvsportal_t *pvsportals;
+static int         numpvscells, numpvsportals;
+static boolean    *pvsonpath;       // cells on the current line of portals
+static pvsarea_t  *pvssources;      // clipped source area by portal depth
+static uint32_t   *pvsflowset;      // set being built
+
+#define PVSFREE(x, y) ((unsigned) (x) < MAPSIZE && (unsigned) (y) < MAPSIZE \
+    && !INPVS(pvssolid, x, y))
+
+/*
+===================
+=
+= BuildPVSCells
+=
+= Splits the empty tiles into rectangles
+=
+===================
+*/
+
+static void BuildPVSCells (void)
+{
+    pvscell_t *cell;
+    int        x, y, x2, y2, ty;
+
+    numpvscells = 0;
+    memset (pvscellof, 0xff, sizeof(pvscellof));
+
+    for(x = 0; x < MAPSIZE; x++)
+    {
+        for(y = 0; y < MAPSIZE; y++)
+        {
+            if(!PVSFREE(x, y) || pvscellof[x][y] != PVSNONE)
+                continue;
+
+            for(y2 = y; PVSFREE(x, y2 + 1) && pvscellof[x][y2 + 1] == PVSNONE; y2++);
+            for(x2 = x; x2 + 1 < MAPSIZE; x2++)
+            {
+                for(ty = y; ty <= y2; ty++)
+                    if(!PVSFREE(x2 + 1, ty) || pvscellof[x2 + 1][ty] != PVSNONE)
+                        break;
+                if(ty <= y2)
+                    break;
+            }
+
+            cell = &pvscells[numpvscells];
+            cell->x1 = x;
+            cell->y1 = y;
+            cell->x2 = x2;
+            cell->y2 = y2;
+            for(; x2 >= x; x2--)
+                for(ty = y; ty <= y2; ty++)
+                    pvscellof[x2][ty] = numpvscells;
+            numpvscells++;
+        }
+    }
+}
+
+/*
+===================
+=
+= AddPVSPortal
+=
+===================
+*/
+
+static void AddPVSPortal (double x1, double y1, double x2, double y2,
+    double nx, double ny, int cell)
+{
+    pvsportal_t *portal = &pvsportals[numpvsportals++];
+
+    portal->x1 = x1;
+    portal->y1 = y1;
+    portal->x2 = x2;
+    portal->y2 = y2;
+    portal->nx = nx;
+    portal->ny = ny;
+    portal->cell = cell;
+}
+
+/*
+===================
+=
+= AddPVSSide
+=
+= Adds the portals along one side of a cell. The tiles outside the side are
+= at x, y + i * dy or x + i * dx, y for i = 0..len-1, the border runs along
+= the line at bx or by.
+=
+===================
+*/
+
+static void AddPVSSide (int x, int y, int dx, int dy, int len,
+    double border, double nx, double ny)
+{
+    int i, start, next, cell;
+
+    for(i = 0; i < len; i = next)
+    {
+        cell = PVSFREE(x + i * dx, y + i * dy) ? pvscellof[x + i * dx][y + i * dy] : PVSNONE;
+        start = i;
+        for(next = i + 1; next < len; next++)
+        {
+            if(!PVSFREE(x + next * dx, y + next * dy)
+                || pvscellof[x + next * dx][y + next * dy] != cell)
+                break;
+        }
+        if(cell == PVSNONE)
+            continue;
+
+        if(dy)                      // side along y at x = border
+            AddPVSPortal (border, y + start, border, y + next, nx, ny, cell);
+        else
+            AddPVSPortal (x + start, border, x + next, border, nx, ny, cell);
+    }
+}
+
+/*
+===================
+=
+= AddPVSCorner
+=
+= Adds a portal through the corner of a cell if the tile diagonal to it is
+= only joined to the cell by that corner
+=
+===================
+*/
+
+static void AddPVSCorner (int x, int y, int dx, int dy)
+{
+    if(!PVSFREE(x + dx, y + dy) || PVSFREE(x + dx, y) || PVSFREE(x, y + dy))
+        return;
+
+    double cx = x + (dx > 0), cy = y + (dy > 0);
+    AddPVSPortal (cx, cy, cx, cy, dx * 0.70710678, dy * 0.70710678, pvscellof[x + dx][y + dy]);
+}
+
+/*
+===================
+=
+= BuildPVSPortals
+=
+===================
+*/
+
+static void BuildPVSPortals (void)
+{
+    pvscell_t *cell;
+    int        i, w, h;
+
+    numpvsportals = 0;
+    for(i = 0; i < numpvscells; i++)
+    {
+        cell = &pvscells[i];
+        w = cell->x2 - cell->x1 + 1;
+        h = cell->y2 - cell->y1 + 1;
+        cell->firstportal = numpvsportals;
+
+        AddPVSSide (cell->x1 - 1, cell->y1, 0, 1, h, cell->x1, -1, 0);
+        AddPVSSide (cell->x2 + 1, cell->y1, 0, 1, h, cell->x2 + 1, 1, 0);
+        AddPVSSide (cell->x1, cell->y1 - 1, 1, 0, w, cell->y1, 0, -1);
+        AddPVSSide (cell->x1, cell->y2 + 1, 1, 0, w, cell->y2 + 1, 0, 1);
+        AddPVSCorner (cell->x1, cell->y1, -1, -1);
+        AddPVSCorner (cell->x2, cell->y1, 1, -1);
+        AddPVSCorner (cell->x1, cell->y2, -1, 1);
+        AddPVSCorner (cell->x2, cell->y2, 1, 1);
+
+        cell->numportals = numpvsportals - cell->firstportal;
+    }
+}
+
+/*
+===================
+=
+= PVSTangentPlane
+=
+= Makes the line through a point of the source area and the portal point
+= px, py with the whole source area on its negative side. Returns false if
+= the line doesn't touch the area from outside. Lines from the source
+= through the portal point stay on the positive side behind it.
+=
+===================
+*/
+
+static boolean PVSTangentPlane (pvsarea_t *source, int point, double px, double py,
+    pvsplane_t *plane)
+{
+    double dx, dy, len, d, dmin, dmax;
+    int    i;
+
+    dx = px - source->x[point];
+    dy = py - source->y[point];
+    len = sqrt (dx * dx + dy * dy);
+    if(len < 1e-9)
+        return false;
+
+    plane->a = -dy / len;
+    plane->b = dx / len;
+    plane->c = -(plane->a * px + plane->b * py);
+
+    dmin = dmax = 0;
+    for(i = 0; i < source->numpoints; i++)
+    {
+        d = plane->a * source->x[i] + plane->b * source->y[i] + plane->c;
+        if(d < dmin) dmin = d;
+        if(d > dmax) dmax = d;
+    }
+    if(dmin < -1e-9 && dmax > 1e-9)
+        return false;
+    if(dmax > 1e-9)
+    {
+        plane->a = -plane->a;
+        plane->b = -plane->b;
+        plane->c = -plane->c;
+    }
+    return true;
+}
+
+/*
+===================
+=
+= PVSWedge
+=
+= Returns the planes bounding the area behind a portal which lines from the
+= source through the portal can reach: the line of the portal and at every
+= end point the tangent to the source with the other end point in front of
+= it. For a portal through a corner, both tangents bound the area.
+=
+===================
+*/
+
+static int PVSWedge (pvsarea_t *source, double x1, double y1, double x2, double y2,
+    double nx, double ny, pvsplane_t *planes)
+{
+    double px, py, ox, oy;
+    int    numplanes = 1, end, i;
+
+    planes[0].a = nx;
+    planes[0].b = ny;
+    planes[0].c = -(nx * x1 + ny * y1);
+
+    if(x1 == x2 && y1 == y2)
+    {
+        for(i = 0; i < source->numpoints && numplanes < 3; i++)
+            if(PVSTangentPlane (source, i, x1, y1, &planes[numplanes]))
+                numplanes++;
+        return numplanes;
+    }
+
+    for(end = 0; end < 2; end++)
+    {
+        px = end ? x2 : x1;
+        py = end ? y2 : y1;
+        ox = end ? x1 : x2;
+        oy = end ? y1 : y2;
+        for(i = 0; i < source->numpoints; i++)
+        {
+            if(PVSTangentPlane (source, i, px, py, &planes[numplanes])
+                && planes[numplanes].a * ox + planes[numplanes].b * oy
+                    + planes[numplanes].c > 1e-9)
+            {
+                numplanes++;
+                break;
+            }
+        }
+    }
+    return numplanes;
+}
+
+/*
+===================
+=
+= ClipPVSArea
+=
+= Cuts off the parts of an area outside a plane, returns false if nothing
+= is left
+=
+===================
+*/
+
+static boolean ClipPVSArea (pvsarea_t *area, pvsplane_t *plane)
+{
+    pvsarea_t clipped;
+    double    d[PVSMAXPOINTS], t;
+    int       i, j, in = 0;
+
+    for(i = 0; i < area->numpoints; i++)
+    {
+        d[i] = plane->a * area->x[i] + plane->b * area->y[i] + plane->c + PVSEPSILON;
+        if(d[i] >= 0)
+            in++;
+    }
+    if(!in)
+        return false;
+    if(in == area->numpoints)
+        return true;
+    if(area->numpoints + 1 > PVSMAXPOINTS)
+        return true;                // keep the larger area
+
+    clipped.numpoints = 0;
+    for(i = 0; i < area->numpoints; i++)
+    {
+        j = (i + 1) % area->numpoints;
+        if(d[i] >= 0)
+        {
+            clipped.x[clipped.numpoints] = area->x[i];
+            clipped.y[clipped.numpoints++] = area->y[i];
+        }
+        if((d[i] >= 0) != (d[j] >= 0))
+        {
+            t = d[i] / (d[i] - d[j]);
+            clipped.x[clipped.numpoints] = area->x[i] + t * (area->x[j] - area->x[i]);
+            clipped.y[clipped.numpoints++] = area->y[i] + t * (area->y[j] - area->y[i]);
+        }
+    }
+    *area = clipped;
+    return true;
+}
+
+/*
+===================
+=
+= MarkPVSCell
+=
+= Adds the tiles of a cell touching the area bounded by the planes
+=
+===================
+*/
+
+static void MarkPVSCell (pvscell_t *cell, pvsplane_t *planes, int numplanes)
+{
+    int x, y, i;
+
+    for(x = cell->x1; x <= cell->x2; x++)
+    {
+        for(y = cell->y1; y <= cell->y2; y++)
+        {
+            if(INPVS(pvsflowset, x, y))
+                continue;
+            for(i = 0; i < numplanes; i++)
+            {
+                // distance of the tile corner farthest inside
+                if(planes[i].a * (x + 0.5) + planes[i].b * (y + 0.5) + planes[i].c
+                    + 0.5 * (fabs (planes[i].a) + fabs (planes[i].b)) < -PVSEPSILON)
+                    break;
+            }
+            if(i == numplanes)
+                pvsflowset[(x << 1) + (y >> 5)] |= 1u << (y & 31);
+        }
+    }
+}
+
+/*
+===================
+=
+= FlowPVS
+=
+= Follows the lines from the source area of the given depth through a
+= portal into the cell behind it and on through the portals of that cell
+=
+===================
+*/
+
+static void FlowPVS (int depth, double x1, double y1, double x2, double y2,
+    double nx, double ny, int cellnum)
+{
+    pvsarea_t   *source = &pvssources[depth];
+    pvsarea_t   *next = &pvssources[depth + 1];
+    pvscell_t   *cell = &pvscells[cellnum];
+    pvsportal_t *portal;
+    pvsplane_t   planes[3], back[3];
+    pvsarea_t    line;
+    double       d1, d2, t1, t2, qx1, qy1, qx2, qy2;
+    int          numplanes, numback, i, j;
+
+    numplanes = PVSWedge (source, x1, y1, x2, y2, nx, ny, planes);
+    MarkPVSCell (cell, planes, numplanes);
+
+    pvsonpath[cellnum] = true;
+    for(i = 0; i < cell->numportals; i++)
+    {
+        portal = &pvsportals[cell->firstportal + i];
+        if(pvsonpath[portal->cell])
+            continue;               // lines can't come back into a cell
+
+        //
+        // clip the portal to the lines reaching it
+        //
+        t1 = 0;
+        t2 = 1;
+        for(j = 0; j < numplanes && t1 <= t2; j++)
+        {
+            d1 = planes[j].a * portal->x1 + planes[j].b * portal->y1 + planes[j].c + PVSEPSILON;
+            d2 = planes[j].a * portal->x2 + planes[j].b * portal->y2 + planes[j].c + PVSEPSILON;
+            if(d1 < 0 && d2 < 0)
+                t1 = 2;
+            else if(d1 < 0)
+            {
+                if(d1 / (d1 - d2) > t1)
+                    t1 = d1 / (d1 - d2);
+            }
+            else if(d2 < 0)
+            {
+                if(d1 / (d1 - d2) < t2)
+                    t2 = d1 / (d1 - d2);
+            }
+        }
+        if(t1 > t2)
+            continue;
+        qx1 = portal->x1 + t1 * (portal->x2 - portal->x1);
+        qy1 = portal->y1 + t1 * (portal->y2 - portal->y1);
+        qx2 = portal->x1 + t2 * (portal->x2 - portal->x1);
+        qy2 = portal->y1 + t2 * (portal->y2 - portal->y1);
+
+        //
+        // only the part of the source which can see that part through the
+        // portal passed last matters behind it
+        //
+        *next = *source;
+        line.numpoints = 2;
+        line.x[0] = qx1;
+        line.y[0] = qy1;
+        line.x[1] = qx2;
+        line.y[1] = qy2;
+        numback = PVSWedge (&line, x1, y1, x2, y2, -nx, -ny, back);
+        for(j = 0; j < numback; j++)
+            if(!ClipPVSArea (next, &back[j]))
+                break;
+        if(j < numback)
+            continue;
+
+        FlowPVS (depth + 1, qx1, qy1, qx2, qy2, portal->nx, portal->ny, portal->cell);
+    }
+    pvsonpath[cellnum] = false;
+}
+
+/*
+===================
+=
+= WidenPVSSet
+=
+= Adds the eight neighbours of every tile in the set
+=
+===================
+*/
+
+static void WidenPVSSet (uint32_t *set)
+{
+    uint32_t cols[PVSSETWORDS];
+    uint32_t lo, hi;
+    int      x;
+
+    for(x = 0; x < MAPSIZE; x++)
+    {
+        lo = set[x << 1];
+        hi = set[(x << 1) + 1];
+        cols[x << 1] = lo | (lo << 1) | (lo >> 1) | (hi << 31);
+        cols[(x << 1) + 1] = hi | (hi << 1) | (hi >> 1) | (lo >> 31);
+    }
+
+    for(x = 0; x < MAPSIZE; x++)
+    {
+        lo = cols[x << 1];
+        hi = cols[(x << 1) + 1];
+        if(x > 0)
+        {
+            lo |= cols[(x - 1) << 1];
+            hi |= cols[((x - 1) << 1) + 1];
+        }
+        if(x < MAPSIZE - 1)
+        {
+            lo |= cols[(x + 1) << 1];
+            hi |= cols[((x + 1) << 1) + 1];
+        }
+        set[x << 1] = lo;
+        set[(x << 1) + 1] = hi;
+    }
+}
+
+/*
+===================
+=
+= BuildPVS
+=
+= Builds the sets of all non solid tiles
+=
+===================
+*/
+
+static void BuildPVS (void)
+{
+    pvscell_t   *cell;
+    pvsportal_t *portal;
+    pvsarea_t   *source;
+    int          x, y, i;
+
+    pvscells = (pvscell_t *) malloc (maparea * sizeof(pvscell_t));
+    pvsportals = (pvsportal_t *) malloc (maparea * 8 * sizeof(pvsportal_t));
+    pvsonpath = (boolean *) calloc (maparea, sizeof(boolean));
+    pvssources = (pvsarea_t *) malloc ((maparea + 1) * sizeof(pvsarea_t));
+    CHECKMALLOCRESULT(pvscells);
+    CHECKMALLOCRESULT(pvsportals);
+    CHECKMALLOCRESULT(pvsonpath);
+    CHECKMALLOCRESULT(pvssources);
+
+    BuildPVSCells ();
+    BuildPVSPortals ();
+
+    for(x = 0; x < MAPSIZE; x++)
+    {
+        for(y = 0; y < MAPSIZE; y++)
+        {
+            if(pvsindex[x][y] == PVSNONE)
+                continue;
+            pvsflowset = pvssets + pvsindex[x][y] * PVSSETWORDS;
+            memset (pvsflowset, 0, PVSSETWORDS * sizeof(uint32_t));
+
+            //
+            // the whole cell of the tile can be seen, the rest only through
+            // its portals
+            //
+            cell = &pvscells[pvscellof[x][y]];
+            MarkPVSCell (cell, NULL, 0);
+
+            source = &pvssources[0];
+            source->numpoints = 4;
+            source->x[0] = x;     source->y[0] = y;
+            source->x[1] = x + 1; source->y[1] = y;
+            source->x[2] = x + 1; source->y[2] = y + 1;
+            source->x[3] = x;     source->y[3] = y + 1;
+
+            pvsonpath[pvscellof[x][y]] = true;
+            for(i = 0; i < cell->numportals; i++)
+            {
+                portal = &pvsportals[cell->firstportal + i];
+                FlowPVS (0, portal->x1, portal->y1, portal->x2, portal->y2,
+                    portal->nx, portal->ny, portal->cell);
+            }
+            pvsonpath[pvscellof[x][y]] = false;
+
+            WidenPVSSet (pvsflowset);
+            WidenPVSSet (pvsflowset);
+        }
+    }
+
+    free (pvscells);
+    free (pvsportals);
+    free (pvsonpath);
+    free (pvssources);
+}
+
+/*
+===================
+=
+= LoadPVS
+=
+= Reads the sets from the cache file, if it was built for the same walls
+=
+===================
+*/
+
+static boolean LoadPVS (const char *path)
+{
+    pvsheader_t header;
+    uint32_t   *set;
+    byte        range[2];
+    int         i, count;
+
+    const int file = open (path, O_RDONLY | O_BINARY);
+    if(file == -1)
+        return false;
+
+    if(read (file, &header, sizeof(header)) != sizeof(header)
+        || memcmp (header.id, "WPVS", 4) || header.version != PVSVERSION
+        || header.numsets != numpvssets
+        || memcmp (header.solid, pvssolid, sizeof(pvssolid)))
+    {
+        close (file);
+        return false;
+    }
+
+    //
+    // every set is stored as the range of map columns it covers
+    //
+    for(i = 0; i < numpvssets; i++)
+    {
+        set = pvssets + i * PVSSETWORDS;
+        memset (set, 0, PVSSETWORDS * sizeof(uint32_t));
+        if(read (file, range, sizeof(range)) != sizeof(range)
+            || range[0] > range[1] || range[1] >= MAPSIZE)
+            break;
+        count = (range[1] - range[0] + 1) * 2 * sizeof(uint32_t);
+        if(read (file, set + (range[0] << 1), count) != count)
+            break;
+    }
+    close (file);
+
+    return i == numpvssets;
+}
+
+/*
+===================
+=
+= SavePVS
+=
+===================
+*/
+
+static void SavePVS (const char *path)
+{
+    pvsheader_t header;
+    uint32_t   *set;
+    byte        range[2];
+    int         i;
+
+    const int file = open (path, O_CREAT | O_WRONLY | O_TRUNC | O_BINARY, 0644);
+    if(file == -1)
+        return;                     // the sets are just traced again next time
+
+    memcpy (header.id, "WPVS", 4);
+    header.version = PVSVERSION;
+    header.numsets = numpvssets;
+    memcpy (header.solid, pvssolid, sizeof(pvssolid));
+    write (file, &header, sizeof(header));
+
+    for(i = 0; i < numpvssets; i++)
+    {
+        set = pvssets + i * PVSSETWORDS;
+        for(range[0] = 0; !(set[range[0] << 1] | set[(range[0] << 1) + 1]); range[0]++);
+        for(range[1] = MAPSIZE - 1; !(set[range[1] << 1] | set[(range[1] << 1) + 1]); range[1]--);
+        write (file, range, sizeof(range));
+        write (file, set + (range[0] << 1), (range[1] - range[0] + 1) * 2 * sizeof(uint32_t));
+    }
+    close (file);
+}
+
+/*
+===================
+=
+= SetupPVS
+=
+= Loads or builds the sets of the current map.
+= Must be called after the doors have been spawned and the ambush tiles
+= have been taken out of tilemap.
+=
+===================
+*/
+
+void SetupPVS (int mapnum)
+{
+    char     name[16], path[300];
+    unsigned tile;
+    int      x, y;
+
+    memset (pvssolid, 0, sizeof(pvssolid));
+    numpvssets = 0;
+    for(x = 0; x < MAPSIZE; x++)
+    {
+        for(y = 0; y < MAPSIZE; y++)
+        {
+            tile = tilemap[x][y];
+            if(tile && !(tile & 0x80) && MAPSPOT(x, y, 1) != PUSHABLETILE)
+            {
+                pvssolid[(x << 1) + (y >> 5)] |= 1u << (y & 31);
+                pvsindex[x][y] = PVSNONE;
+            }
+            else
+                pvsindex[x][y] = numpvssets++;
+        }
+    }
+
+    free (pvssets);
+    pvssets = (uint32_t *) malloc (numpvssets * PVSSETWORDS * sizeof(uint32_t));
+    CHECKMALLOCRESULT(pvssets);
+    viewpvs = NULL;                 // no culling until the first refresh picks a set
+
+    snprintf (name, sizeof(name), "pvs%02d.%s", mapnum, extension);
+    if(configdir[0])
+        snprintf (path, sizeof(path), "%s/%s", configdir, name);
+    else
+        strcpy (path, name);
+
+    if(!LoadPVS (path))
+    {
+        BuildPVS ();
+        SavePVS (path);
+    }
+}
+
+void FreePVS (void)
+{
+    free (pvssets);
+    pvssets = NULL;
+    viewpvs = NULL;
+}
+
+#endif
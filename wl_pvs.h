@@ -0,0 +1,24 @@
+#if defined(USE_PVS) && !defined(_WL_PVS_H_)
+#define _WL_PVS_H_
+
+#define PVSSETWORDS (MAPSIZE * MAPSIZE / 32)    // one bit per tile, two words per map column
+#define PVSNONE     0xffff
+
+#define INPVS(set, x, y) ((set)[((x) << 1) + ((y) >> 5)] & (1u << ((y) & 31)))
+
+extern word      pvsindex[MAPSIZE][MAPSIZE];
+extern uint32_t *pvssets;
+extern uint32_t *viewpvs;
+
+void SetupPVS (int mapnum);
+void FreePVS (void);
+
+// Returns the potentially visible set of the given tile or NULL for tiles
+// no set has been built for (solid walls)
+static inline uint32_t *TilePVS (int x, int y)
+{
+    word index = pvsindex[x][y];
+    return index == PVSNONE ? NULL : pvssets + index * PVSSETWORDS;
+}
+
+#endif
@@ -53,29 +53,8 @@ static int GetShadeDefID()
 #endif
 
 
-// Returns the palette index of the nearest matching color of the
-// given RGB color in given palette
-byte GetColor(byte red, byte green, byte blue, SDL_Color *palette)
-{
-    byte mincol = 0;
-    double mindist = 200000.F, curdist, DRed, DGreen, DBlue;
-
-    SDL_Color *palPtr = palette;
-
-    for(int col = 0; col < 256; col++, palPtr++)
-    {
-        DRed   = (double) (red   - palPtr->r);
-        DGreen = (double) (green - palPtr->g);
-        DBlue  = (double) (blue  - palPtr->b);
-        curdist = DRed * DRed + DGreen * DGreen + DBlue * DBlue;
-        if(curdist < mindist)
-        {
-            mindist = curdist;
-            mincol = (byte) col;
-        }
-    }
-    return mincol;
-}
+static uint8_t shadecache[lengthof(shadeDefs)][SHADE_COUNT][256];
+static boolean shadecached[lengthof(shadeDefs)];
 
 // Fade all colors in 32 steps down to the destination-RGB
 // (use gray for fogging, black for standard shading)
@@ -88,6 +67,8 @@ void GenerateShadeTable(byte destRed, byte destGreen, byte destBlue,
     // Set the fog-flag
     LSHADE_flag=fog;
 
+    VL_SetFindColorPalette(palette);
+
     // Color loop
     for(int i = 0; i < 256; i++, palPtr++)
     {
@@ -104,7 +85,7 @@ void GenerateShadeTable(byte destRed, byte destGreen, byte destBlue,
         // Calc color for each shade of the current color
         for (int shade = 0; shade < SHADE_COUNT; shade++)
         {
-            shadetable[shade][i] = GetColor((byte) curRed, (byte) curGreen, (byte) curBlue, palette);
+            shadetable[shade][i] = VL_FindColor((byte) curRed, (byte) curGreen, (byte) curBlue);
 
             // Inc to next shade
             curRed   += redStep;
@@ -121,18 +102,183 @@ void NoShading()
             shadetable[shade][i] = i;
 }
 
+/*
+=============================================================================
+
+                         PRE-SHADED WALL TEXTURES
+
+ ShadedTexture returns a copy of a wall texture with shadetable[shade]
+ already applied, so ScalePost only needs one lookup per pixel. The copies
+ are built on first use and kept in up to param_shadecache KB, dropping
+ the least recently used one when the budget is full. The hits and misses
+ per shade are printed on shutdown to help choosing the budget.
+
+=============================================================================
+*/
+
+#define SHADEDTEXSIZE (TEXTURESIZE * TEXTURESIZE)
+
+typedef struct
+{
+    int   key;                          // page * SHADE_COUNT + shade
+    byte *texels;
+    short prev, next;                   // LRU order, most recently used first
+} shadedtex_t;
+
+static shadedtex_t *shadedtex;
+static int          numshadedtex, usedshadedtex;
+static short       *shadedslot;         // slot of every page and shade or -1
+static short        shadedhead = -1, shadedtail = -1;
+
+uint32_t shadedhits[SHADE_COUNT], shadedmisses[SHADE_COUNT];
+
+static void FlushShadedTextures()
+{
+    if(shadedslot)
+        memset(shadedslot, 0xff, PMSpriteStart * SHADE_COUNT * sizeof(short));
+    usedshadedtex = 0;
+    shadedhead = shadedtail = -1;
+}
+
+static void UnlinkShadedTexture(int slot)
+{
+    shadedtex_t *tex = &shadedtex[slot];
+    if(tex->prev >= 0) shadedtex[tex->prev].next = tex->next;
+    else shadedhead = tex->next;
+    if(tex->next >= 0) shadedtex[tex->next].prev = tex->prev;
+    else shadedtail = tex->prev;
+}
+
+static void LinkShadedTexture(int slot)
+{
+    shadedtex_t *tex = &shadedtex[slot];
+    tex->prev = -1;
+    tex->next = shadedhead;
+    if(shadedhead >= 0) shadedtex[shadedhead].prev = slot;
+    else shadedtail = slot;
+    shadedhead = slot;
+}
+
+// Returns the wall texture page with the given shade applied or NULL if
+// there is no cache
+byte *ShadedTexture(int page, int shade)
+{
+    int key, slot;
+
+#ifdef USE_MTRENDER
+    if(renderthreads > 1)
+        return NULL;                    // the cache isn't shared between render threads
+#endif
+    if(!shadedslot)
+    {
+        numshadedtex = param_shadecache * 1024 / SHADEDTEXSIZE;
+        if(numshadedtex > 0x7fff) numshadedtex = 0x7fff;
+        if(!numshadedtex)
+            return NULL;
+
+        shadedtex = (shadedtex_t *) calloc(numshadedtex, sizeof(shadedtex_t));
+        CHECKMALLOCRESULT(shadedtex);
+        shadedslot = (short *) malloc(PMSpriteStart * SHADE_COUNT * sizeof(short));
+        CHECKMALLOCRESULT(shadedslot);
+        FlushShadedTextures();
+    }
+
+    key = page * SHADE_COUNT + shade;
+    slot = shadedslot[key];
+    if(slot >= 0)
+    {
+        shadedhits[shade]++;
+        if(slot != shadedhead)
+        {
+            UnlinkShadedTexture(slot);
+            LinkShadedTexture(slot);
+        }
+        return shadedtex[slot].texels;
+    }
+    shadedmisses[shade]++;
+
+    if(usedshadedtex < numshadedtex)
+    {
+        slot = usedshadedtex++;
+        shadedtex[slot].texels = (byte *) malloc(SHADEDTEXSIZE);
+        CHECKMALLOCRESULT(shadedtex[slot].texels);
+    }
+    else
+    {
+        slot = shadedtail;
+        shadedslot[shadedtex[slot].key] = -1;
+        UnlinkShadedTexture(slot);
+    }
+
+    byte *src = PM_GetTexture(page);
+    byte *dest = shadedtex[slot].texels;
+    byte *curshades = shadetable[shade];
+    for(int i = 0; i < SHADEDTEXSIZE; i++)
+        dest[i] = curshades[src[i]];
+
+    shadedtex[slot].key = key;
+    shadedslot[key] = slot;
+    LinkShadedTexture(slot);
+    return dest;
+}
+
+void ShutdownShadedTextures()
+{
+    uint32_t hits = 0, misses = 0;
+    int shade;
+
+    for(shade = 0; shade < SHADE_COUNT; shade++)
+    {
+        hits += shadedhits[shade];
+        misses += shadedmisses[shade];
+    }
+    if(hits + misses)
+    {
+        printf("shadecache: %i KB, %u hits, %u misses, hit rate per shade:",
+            numshadedtex * SHADEDTEXSIZE / 1024, hits, misses);
+        for(shade = 0; shade < SHADE_COUNT; shade++)
+        {
+            if(shadedhits[shade] + shadedmisses[shade])
+                printf(" %i:%u%%", shade, (uint32_t) ((uint64_t) shadedhits[shade] * 100
+                    / (shadedhits[shade] + shadedmisses[shade])));
+        }
+        printf("\n");
+    }
+
+    for(int i = 0; i < usedshadedtex; i++)
+        free(shadedtex[i].texels);
+    free(shadedtex);
+    free(shadedslot);
+    shadedtex = NULL;
+    shadedslot = NULL;
+    numshadedtex = usedshadedtex = 0;
+}
+
+// The shade tables of gamepal are kept for every definition used, so
+// they only have to be generated on the first level using them
 void InitLevelShadeTable()
 {
-    shadedef_t *shadeDef = &shadeDefs[GetShadeDefID()];
+    int shadeID = GetShadeDefID();
+    shadedef_t *shadeDef = &shadeDefs[shadeID];
     if(shadeDef->fogStrength == LSHADE_NOSHADING)
         NoShading();
+    else if(shadecached[shadeID])
+    {
+        memcpy(shadetable, shadecache[shadeID], sizeof(shadetable));
+        LSHADE_flag = shadeDef->fogStrength;
+    }
     else
+    {
         GenerateShadeTable(shadeDef->destRed, shadeDef->destGreen, shadeDef->destBlue, gamepal, shadeDef->fogStrength);
+        memcpy(shadecache[shadeID], shadetable, sizeof(shadetable));
+        shadecached[shadeID] = true;
+    }
+    FlushShadedTextures();
 }
 
 int GetShade(int scale)
 {
-    int shade = (scale >> 1) / (((viewwidth * 3) >> 8) + 1 + LSHADE_flag);  // TODO: reconsider this...
+    int shade = (scale >> 1) / ((((viewwidth << detailshift) * 3) >> 8) + 1 + LSHADE_flag);  // TODO: reconsider this...
     if(shade > 32) shade = 32;
     else if(shade < 1) shade = 1;
     shade = 32 - shade;
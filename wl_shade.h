@@ -8,8 +8,11 @@
 #define LSHADE_FOG 5
 
 extern uint8_t shadetable[SHADE_COUNT][256];
+extern uint32_t shadedhits[SHADE_COUNT], shadedmisses[SHADE_COUNT];
 
 void InitLevelShadeTable();
 int GetShade(int scale);
+byte *ShadedTexture(int page, int shade);
+void ShutdownShadedTextures();
 
 #endif
@@ -1,6 +1,7 @@
 // WL_STATE.C
 
 #include "wl_def.h"
+#include "wl_pvs.h"
 #pragma hdrstop
 
 /*
@@ -1284,6 +1285,17 @@ boolean CheckSight (objtype *ob)
             break;
     }
 
+#ifdef USE_PVS
+    //
+    // don't bother tracing a line if the tile can't be seen from the player's
+    // (the sets leave room for CheckLine slipping past corners, but demos
+    // keep using it alone all the same)
+    //
+    uint32_t *pvs = TilePVS (player->tilex, player->tiley);
+    if (DEMOCOND_SDL && pvs && !INPVS(pvs, ob->x >> TILESHIFT, ob->y >> TILESHIFT))
+        return false;
+#endif
+
     //
     // trace a line to check for blocking tiles (corners)
     //